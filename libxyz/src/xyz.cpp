@@ -0,0 +1,1301 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "xyz.h"
+#include "xyz_backend.h"
+#include "xyz_pool.h"
+#include <zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#if defined(HAVE_LIBDEFLATE) || defined(HAVE_ZLIBNG)
+# define XYZ_BUFFER_BACKENDS
+#endif
+
+namespace {
+	/** Backend selected by SetBackend or XYZ_BACKEND, -1 until first use. */
+	std::atomic<int> current_backend(-1);
+
+	/** zlib counts bytes in uInt, larger buffers are passed in chunks. */
+	uInt GetChunk(size_t remaining) {
+		const uInt max_chunk = static_cast<uInt>(-1);
+		return remaining > max_chunk ? max_chunk : static_cast<uInt>(remaining);
+	}
+
+	/** Returns the maximum zlib stream size of zlib, in size_t. */
+	size_t GetDeflateBoundZlib(size_t size) {
+		return size + (size >> 12) + (size >> 14) + (size >> 25) + 13;
+	}
+
+	/**
+	 * zlib streams of the whole buffer functions, kept per thread and
+	 * reset for every call, so batch runs do not set up zlib for every
+	 * file.
+	 */
+	class StreamCache {
+	public:
+		StreamCache() : inflate_ready(false), deflate_ready(false),
+			deflate_level(0), deflate_window_bits(0) {
+		}
+
+		~StreamCache() {
+			if (inflate_ready) {
+				inflateEnd(&inflate_strm);
+			}
+			if (deflate_ready) {
+				deflateEnd(&deflate_strm);
+			}
+		}
+
+		/** Returns a reset inflate stream, NULL when out of memory. */
+		z_stream* GetInflate(int window_bits) {
+			if (!inflate_ready) {
+				memset(&inflate_strm, 0, sizeof(inflate_strm));
+				if (inflateInit2(&inflate_strm, window_bits) != Z_OK) {
+					return NULL;
+				}
+				inflate_ready = true;
+			} else if (inflateReset2(&inflate_strm, window_bits) != Z_OK) {
+				return NULL;
+			}
+
+			Clear(inflate_strm);
+			return &inflate_strm;
+		}
+
+		/** Returns a reset deflate stream, NULL with a zlib status on error. */
+		z_stream* GetDeflate(int level, int window_bits, int& status) {
+			status = Z_OK;
+			if (deflate_ready && (level != deflate_level ||
+				window_bits != deflate_window_bits)) {
+				deflateEnd(&deflate_strm);
+				deflate_ready = false;
+			}
+
+			if (!deflate_ready) {
+				memset(&deflate_strm, 0, sizeof(deflate_strm));
+				status = deflateInit2(&deflate_strm, level, Z_DEFLATED,
+					window_bits, 8, Z_DEFAULT_STRATEGY);
+				if (status != Z_OK) {
+					return NULL;
+				}
+				deflate_ready = true;
+				deflate_level = level;
+				deflate_window_bits = window_bits;
+			} else {
+				status = deflateReset(&deflate_strm);
+				if (status != Z_OK) {
+					return NULL;
+				}
+			}
+
+			Clear(deflate_strm);
+			return &deflate_strm;
+		}
+
+	private:
+		StreamCache(const StreamCache&);
+		StreamCache& operator=(const StreamCache&);
+
+		/** Resetting keeps the buffer pointers of the last call. */
+		static void Clear(z_stream& strm) {
+			strm.next_in = Z_NULL;
+			strm.avail_in = 0;
+			strm.next_out = Z_NULL;
+			strm.avail_out = 0;
+		}
+
+		z_stream inflate_strm;
+		z_stream deflate_strm;
+		bool inflate_ready;
+		bool deflate_ready;
+		int deflate_level;
+		int deflate_window_bits;
+	};
+
+	StreamCache& GetStreamCache() {
+		thread_local StreamCache cache;
+		return cache;
+	}
+
+	/** Scratch buffer for encoders that need palette and pixels joined. */
+	std::vector<unsigned char>& GetScratch() {
+		thread_local std::vector<unsigned char> scratch;
+		return scratch;
+	}
+
+	/** Returns palette and pixels as one buffer, copied if necessary. */
+	const unsigned char* JoinImage(const unsigned char* palette,
+		const unsigned char* pixels, size_t size) {
+		if (pixels == palette + Xyz::PaletteSize) {
+			return palette;
+		}
+
+		std::vector<unsigned char>& scratch = GetScratch();
+		scratch.resize(size);
+		memcpy(&scratch.front(), palette, Xyz::PaletteSize);
+		memcpy(&scratch.front() + Xyz::PaletteSize, pixels,
+			size - Xyz::PaletteSize);
+		return &scratch.front();
+	}
+
+	/** Writes the signature and the image dimensions. */
+	void WriteHeader(const Xyz::Header& header, unsigned char* out) {
+		memcpy(out, "XYZ1", 4);
+		out[4] = header.width & 0xFF;
+		out[5] = header.width >> 8;
+		out[6] = header.height & 0xFF;
+		out[7] = header.height >> 8;
+	}
+
+	/** Input bytes per block of EncodeParallel, as in pigz. */
+	const size_t ParallelBlockSize = 128 * 1024;
+
+	/** Bytes of the previous block used as dictionary, the deflate window. */
+	const size_t DictionarySize = 32 * 1024;
+
+	/** A block of EncodeParallel, deflated independently of the others. */
+	struct ParallelBlock {
+		std::vector<unsigned char> data;
+		uLong adler;
+		Xyz::Result result;
+	};
+
+	/**
+	 * Deflates a block into raw deflate data ending on a byte boundary,
+	 * the last block also ends the deflate stream.
+	 */
+	void DeflateBlock(const unsigned char* in, size_t offset, size_t size,
+		bool last, int level, ParallelBlock& block) {
+		block.adler = adler32(1L, in + offset, static_cast<uInt>(size));
+
+		int status;
+		z_stream* strm = GetStreamCache().GetDeflate(level, -MAX_WBITS, status);
+		if (strm == NULL) {
+			block.result = status == Z_MEM_ERROR ? Xyz::ErrorMemory :
+				Xyz::ErrorData;
+			return;
+		}
+
+		// Continue where the previous block ended
+		if (offset > 0) {
+			size_t dictionary = std::min(offset, DictionarySize);
+			deflateSetDictionary(strm, in + offset - dictionary,
+				static_cast<uInt>(dictionary));
+		}
+
+		// Room for the flush marker and the pending bits in front of it
+		block.data.resize(deflateBound(strm, static_cast<uLong>(size)) + 16);
+		strm->next_in = const_cast<Bytef*>(in + offset);
+		strm->avail_in = static_cast<uInt>(size);
+		strm->next_out = &block.data.front();
+		strm->avail_out = static_cast<uInt>(block.data.size());
+
+		status = deflate(strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+		bool complete = last ? status == Z_STREAM_END :
+			status == Z_OK && strm->avail_in == 0 && strm->avail_out > 0;
+		block.result = complete ? Xyz::Ok : Xyz::ErrorData;
+		block.data.resize(block.data.size() - strm->avail_out);
+	}
+
+	/**
+	 * Deflates all of in to dst, ending with a flush mode. dst and
+	 * dst_left are advanced past the output.
+	 */
+	Xyz::Result DeflateInto(z_stream* strm, const unsigned char* in,
+		size_t in_left, int flush, unsigned char*& dst, size_t& dst_left) {
+		for (;;) {
+			if (strm->avail_in == 0 && in_left > 0) {
+				strm->next_in = const_cast<Bytef*>(in);
+				strm->avail_in = GetChunk(in_left);
+				in += strm->avail_in;
+				in_left -= strm->avail_in;
+			}
+
+			strm->next_out = dst;
+			strm->avail_out = GetChunk(dst_left);
+			size_t available = strm->avail_out;
+
+			int mode = in_left == 0 ? flush : Z_NO_FLUSH;
+			int status = deflate(strm, mode);
+			dst += available - strm->avail_out;
+			dst_left -= available - strm->avail_out;
+
+			if (status == Z_STREAM_END) {
+				return Xyz::Ok;
+			}
+			if (status == Z_STREAM_ERROR) {
+				return Xyz::ErrorData;
+			}
+			// A flush is complete when zlib did not fill the buffer
+			if (mode != Z_NO_FLUSH && mode != Z_FINISH &&
+				strm->avail_in == 0 && strm->avail_out > 0) {
+				return Xyz::Ok;
+			}
+			if (dst_left == 0) {
+				return Xyz::ErrorBufferSize;
+			}
+		}
+	}
+
+	/**
+	 * Inflates the palette of a zlib stream written by EncodeSplit and
+	 * finds the offset of the pixel data behind the flush point. The
+	 * palette must be followed by the empty stored block of the flush,
+	 * which ends on a byte boundary.
+	 */
+	Xyz::Result FindSplit(const unsigned char* in, size_t in_size,
+		unsigned char* palette, size_t& offset) {
+		z_stream* strm = GetStreamCache().GetInflate(MAX_WBITS);
+		if (strm == NULL) {
+			return Xyz::ErrorMemory;
+		}
+
+		strm->next_in = const_cast<Bytef*>(in);
+		strm->avail_in = GetChunk(in_size);
+		strm->next_out = palette;
+		strm->avail_out = Xyz::PaletteSize;
+
+		// Z_BLOCK stops at every block boundary, data_type tells the state
+		for (;;) {
+			int status = inflate(strm, Z_BLOCK);
+			if (status == Z_MEM_ERROR) {
+				return Xyz::ErrorMemory;
+			}
+			if (status == Z_DATA_ERROR) {
+				return Xyz::ErrorData;
+			}
+			if (status != Z_OK) {
+				break;
+			}
+
+			bool boundary = (strm->data_type & 128) != 0;
+			bool last = (strm->data_type & 64) != 0;
+			bool aligned = (strm->data_type & 63) == 0;
+			if (strm->avail_out > 0 || !boundary) {
+				continue;
+			}
+			if (last) {
+				break;
+			}
+
+			offset = strm->next_in - in;
+			if (aligned && offset >= 6 &&
+				memcmp(in + offset - 4, "\x00\x00\xFF\xFF", 4) == 0) {
+				return Xyz::Ok;
+			}
+		}
+
+		return strm->avail_out > 0 ? Xyz::ErrorTruncated : Xyz::ErrorNotSplit;
+	}
+
+	/**
+	 * Inflates the pixels of a zlib stream written by EncodeSplit from the
+	 * flush point on, with an empty window. Fails with ErrorNotSplit when
+	 * they refer back into the palette, as they do behind a sync flush.
+	 */
+	Xyz::Result InflatePixels(const unsigned char* in, size_t in_size,
+		size_t pixels_size, uLong& adler) {
+		z_stream* strm = GetStreamCache().GetInflate(-MAX_WBITS);
+		if (strm == NULL) {
+			return Xyz::ErrorMemory;
+		}
+
+		unsigned char sink[32 * 1024];
+		size_t inflated_size = 0;
+		size_t in_left = in_size;
+		adler = adler32(0L, Z_NULL, 0);
+		int status = Z_OK;
+
+		while (status == Z_OK && inflated_size <= pixels_size) {
+			if (strm->avail_in == 0) {
+				if (in_left == 0) {
+					break;
+				}
+				strm->next_in = const_cast<Bytef*>(in);
+				strm->avail_in = GetChunk(in_left);
+				in += strm->avail_in;
+				in_left -= strm->avail_in;
+			}
+
+			strm->next_out = sink;
+			strm->avail_out = sizeof(sink);
+			status = inflate(strm, Z_NO_FLUSH);
+
+			uInt produced = static_cast<uInt>(sizeof(sink)) - strm->avail_out;
+			adler = adler32(adler, sink, produced);
+			inflated_size += produced;
+		}
+
+		if (status == Z_MEM_ERROR) {
+			return Xyz::ErrorMemory;
+		}
+		if (status == Z_DATA_ERROR && strm->msg != NULL &&
+			strcmp(strm->msg, "invalid distance too far back") == 0) {
+			return Xyz::ErrorNotSplit;
+		}
+		if (status != Z_OK && status != Z_STREAM_END) {
+			return Xyz::ErrorData;
+		}
+		if (inflated_size > pixels_size) {
+			return Xyz::ErrorLength;
+		}
+		if (status != Z_STREAM_END) {
+			return Xyz::ErrorTruncated;
+		}
+		if (inflated_size != pixels_size) {
+			return Xyz::ErrorLength;
+		}
+		return strm->avail_in + in_left > 0 ? Xyz::ErrorTrailing : Xyz::Ok;
+	}
+
+	/**
+	 * Returns the maximum size of the zlib stream of EncodeParallel. Every
+	 * block may fall back to stored blocks and ends in a flush marker,
+	 * which a single stream does not pay for.
+	 */
+	size_t GetDeflateBoundParallel(size_t size) {
+		size_t count = (size + ParallelBlockSize - 1) / ParallelBlockSize;
+		if (count == 0) {
+			return GetDeflateBoundZlib(size);
+		}
+
+		size_t last = size - (count - 1) * ParallelBlockSize;
+		return 6 + (count - 1) * (GetDeflateBoundZlib(ParallelBlockSize) + 5) +
+			GetDeflateBoundZlib(last) + 5;
+	}
+
+	/**
+	 * Returns the maximum size of the zlib stream of EncodeSplit. The
+	 * palette may be stored, its block header and the empty stored block
+	 * of the flush take up to 5 bytes each, the pixels then start like a
+	 * new stream.
+	 */
+	size_t GetDeflateBoundSplit(size_t pixels_size) {
+		return Xyz::PaletteSize + 10 + GetDeflateBoundZlib(pixels_size);
+	}
+
+#ifdef XYZ_BUFFER_BACKENDS
+	Xyz::Result InflateBuffer(Xyz::Backend backend, const unsigned char* in,
+		size_t in_size, unsigned char* out, size_t out_size) {
+		switch (backend) {
+#ifdef HAVE_LIBDEFLATE
+			case Xyz::BackendLibdeflate:
+				return Xyz::InflateLibdeflate(in, in_size, out, out_size);
+#endif
+#ifdef HAVE_ZLIBNG
+			case Xyz::BackendZlibNg:
+				return Xyz::InflateZlibNg(in, in_size, out, out_size);
+#endif
+			default:
+				break;
+		}
+		return Xyz::ErrorData;
+	}
+
+	Xyz::Result DeflateBuffer(Xyz::Backend backend, const unsigned char* in,
+		size_t in_size, unsigned char* out, size_t& out_size, int level) {
+		switch (backend) {
+#ifdef HAVE_LIBDEFLATE
+			case Xyz::BackendLibdeflate:
+				return Xyz::DeflateLibdeflate(in, in_size, out, out_size, level);
+#endif
+#ifdef HAVE_ZLIBNG
+			case Xyz::BackendZlibNg:
+				return Xyz::DeflateZlibNg(in, in_size, out, out_size, level);
+#endif
+			default:
+				break;
+		}
+		return Xyz::ErrorData;
+	}
+#endif
+}
+
+bool Xyz::IsBackendAvailable(Backend backend) {
+	switch (backend) {
+		case BackendZlib:
+			return true;
+		case BackendZlibNg:
+#ifdef HAVE_ZLIBNG
+			return true;
+#else
+			return false;
+#endif
+		case BackendLibdeflate:
+#ifdef HAVE_LIBDEFLATE
+			return true;
+#else
+			return false;
+#endif
+	}
+	return false;
+}
+
+const char* Xyz::GetBackendName(Backend backend) {
+	switch (backend) {
+		case BackendZlib:
+			return "zlib";
+		case BackendZlibNg:
+			return "zlib-ng";
+		case BackendLibdeflate:
+			return "libdeflate";
+	}
+	return "unknown";
+}
+
+bool Xyz::FindBackend(const char* name, Backend& backend) {
+	const Backend backends[] = { BackendZlib, BackendZlibNg, BackendLibdeflate };
+
+	for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		if (strcmp(name, GetBackendName(backends[i])) == 0) {
+			backend = backends[i];
+			return IsBackendAvailable(backend);
+		}
+	}
+	return false;
+}
+
+Xyz::Backend Xyz::GetBackend() {
+	int backend = current_backend.load();
+	if (backend >= 0) {
+		return static_cast<Backend>(backend);
+	}
+
+	// Fastest one by default, XYZ_BACKEND overrides
+	Backend selected = BackendZlib;
+#if defined(HAVE_LIBDEFLATE)
+	selected = BackendLibdeflate;
+#elif defined(HAVE_ZLIBNG)
+	selected = BackendZlibNg;
+#endif
+	const char* name = getenv("XYZ_BACKEND");
+	Backend requested;
+	if (name != NULL && FindBackend(name, requested)) {
+		selected = requested;
+	}
+
+	current_backend.store(selected);
+	return selected;
+}
+
+bool Xyz::SetBackend(Backend backend) {
+	if (!IsBackendAvailable(backend)) {
+		return false;
+	}
+
+	current_backend.store(backend);
+	return true;
+}
+
+const char* Xyz::GetResultString(Result result) {
+	switch (result) {
+		case Ok:
+			return "no error";
+		case ErrorTruncated:
+			return "file is too short";
+		case ErrorSignature:
+			return "not a XYZ file";
+		case ErrorBufferSize:
+			return "buffer too small";
+		case ErrorData:
+			return "corrupt image data";
+		case ErrorMemory:
+			return "out of memory";
+		case ErrorChecksum:
+			return "checksum mismatch";
+		case ErrorLength:
+			return "image data size mismatch";
+		case ErrorTrailing:
+			return "trailing data after image";
+		case ErrorNotSplit:
+			return "palette is not compressed separately";
+	}
+	return "unknown error";
+}
+
+const char* Xyz::GetResultName(Result result) {
+	switch (result) {
+		case Ok:
+			return "ok";
+		case ErrorTruncated:
+			return "truncated";
+		case ErrorSignature:
+			return "signature";
+		case ErrorBufferSize:
+			return "buffer";
+		case ErrorData:
+			return "data";
+		case ErrorMemory:
+			return "memory";
+		case ErrorChecksum:
+			return "checksum";
+		case ErrorLength:
+			return "length";
+		case ErrorTrailing:
+			return "trailing";
+		case ErrorNotSplit:
+			return "split";
+	}
+	return "unknown";
+}
+
+size_t Xyz::GetPixelsSize(const Header& header) {
+	return static_cast<size_t>(header.width) * header.height;
+}
+
+Xyz::Result Xyz::ReadHeader(const unsigned char* data, size_t size, Header& header) {
+	if (size < HeaderSize) {
+		return ErrorTruncated;
+	}
+
+	if (memcmp(data, "XYZ1", 4) != 0) {
+		return ErrorSignature;
+	}
+
+	header.width = data[4] | (data[5] << 8);
+	header.height = data[6] | (data[7] << 8);
+
+	return Ok;
+}
+
+Xyz::Result Xyz::ReadPalette(const unsigned char* data, size_t size,
+	Header& header, unsigned char* palette) {
+	Result result = ReadHeader(data, size, header);
+	if (result != Ok) {
+		return result;
+	}
+
+	z_stream* strm = GetStreamCache().GetInflate(MAX_WBITS);
+	if (strm == NULL) {
+		return ErrorMemory;
+	}
+
+	// Stop as soon as the palette is complete
+	const unsigned char* in = data + HeaderSize;
+	size_t in_left = size - HeaderSize;
+	strm->next_out = palette;
+	strm->avail_out = PaletteSize;
+	int status = Z_OK;
+
+	while (status == Z_OK && strm->avail_out > 0) {
+		if (strm->avail_in == 0) {
+			if (in_left == 0) {
+				break;
+			}
+			strm->next_in = const_cast<Bytef*>(in);
+			strm->avail_in = GetChunk(in_left);
+			in += strm->avail_in;
+			in_left -= strm->avail_in;
+		}
+
+		status = inflate(strm, Z_NO_FLUSH);
+	}
+
+	bool complete = strm->avail_out == 0;
+
+	if (status == Z_MEM_ERROR) {
+		return ErrorMemory;
+	}
+	if (complete) {
+		return Ok;
+	}
+	return status == Z_OK ? ErrorTruncated : ErrorData;
+}
+
+Xyz::Result Xyz::Decode(const unsigned char* data, size_t size, Header& header,
+	unsigned char* palette, unsigned char* pixels, size_t pixels_size) {
+	Result result = ReadHeader(data, size, header);
+	if (result != Ok) {
+		return result;
+	}
+
+	size_t pixels_total = GetPixelsSize(header);
+	if (pixels_size < pixels_total) {
+		return ErrorBufferSize;
+	}
+
+#ifdef XYZ_BUFFER_BACKENDS
+	Backend backend = GetBackend();
+	if (backend != BackendZlib) {
+		// One contiguous output buffer, the caller's if possible
+		size_t out_size = PaletteSize + pixels_total;
+		bool direct = pixels == palette + PaletteSize;
+		unsigned char* out = palette;
+		if (!direct) {
+			GetScratch().resize(out_size);
+			out = &GetScratch().front();
+		}
+
+		result = InflateBuffer(backend, data + HeaderSize, size - HeaderSize,
+			out, out_size);
+		if (result == Ok && !direct) {
+			memcpy(palette, out, PaletteSize);
+			memcpy(pixels, out + PaletteSize, pixels_total);
+		}
+		return result;
+	}
+#endif
+
+	z_stream* strm = GetStreamCache().GetInflate(MAX_WBITS);
+	if (strm == NULL) {
+		return ErrorMemory;
+	}
+
+	// Inflate the palette and the indices straight into the caller buffers
+	const unsigned char* in = data + HeaderSize;
+	size_t in_left = size - HeaderSize;
+	unsigned char* out = palette;
+	size_t out_left = PaletteSize;
+	bool in_palette = true;
+	int status;
+
+	for (;;) {
+		if (strm->avail_in == 0 && in_left > 0) {
+			strm->next_in = const_cast<Bytef*>(in);
+			strm->avail_in = GetChunk(in_left);
+			in += strm->avail_in;
+			in_left -= strm->avail_in;
+		}
+
+		if (strm->avail_out == 0) {
+			if (out_left == 0 && in_palette) {
+				in_palette = false;
+				out = pixels;
+				out_left = pixels_total;
+			}
+			if (out_left > 0) {
+				strm->next_out = out;
+				strm->avail_out = GetChunk(out_left);
+				out += strm->avail_out;
+				out_left -= strm->avail_out;
+			}
+		}
+
+		status = inflate(strm, Z_NO_FLUSH);
+		if (status != Z_OK) {
+			break;
+		}
+	}
+
+	bool complete = status == Z_STREAM_END && strm->avail_out == 0 &&
+		out_left == 0 && (!in_palette || pixels_total == 0);
+
+
+	if (status == Z_MEM_ERROR) {
+		return ErrorMemory;
+	}
+
+	return complete ? Ok : ErrorData;
+}
+
+Xyz::Result Xyz::Verify(const unsigned char* data, size_t size,
+	VerifyInfo& info) {
+	info.header.width = 0;
+	info.header.height = 0;
+	info.inflated_size = 0;
+	info.trailing_size = 0;
+
+	Result result = ReadHeader(data, size, info.header);
+	if (result != Ok) {
+		return result;
+	}
+
+	// zlib header: deflate, window up to 32 KiB, no preset dictionary
+	const unsigned char* in = data + HeaderSize;
+	size_t in_left = size - HeaderSize;
+	if (in_left < 2) {
+		return ErrorTruncated;
+	}
+	if ((in[0] & 0x0F) != Z_DEFLATED || (in[0] >> 4) > 7 || (in[1] & 0x20) ||
+		((in[0] << 8) | in[1]) % 31 != 0) {
+		return ErrorData;
+	}
+	in += 2;
+	in_left -= 2;
+
+	// Raw inflate, so a bad checksum is told apart from corrupt data
+	z_stream* strm = GetStreamCache().GetInflate(-MAX_WBITS);
+	if (strm == NULL) {
+		return ErrorMemory;
+	}
+
+	unsigned char sink[32 * 1024];
+	size_t expected = PaletteSize + GetPixelsSize(info.header);
+	uLong checksum = adler32(0L, Z_NULL, 0);
+	int status = Z_OK;
+
+	while (status == Z_OK && info.inflated_size <= expected) {
+		if (strm->avail_in == 0) {
+			if (in_left == 0) {
+				break;
+			}
+			strm->next_in = const_cast<Bytef*>(in);
+			strm->avail_in = GetChunk(in_left);
+			in += strm->avail_in;
+			in_left -= strm->avail_in;
+		}
+
+		strm->next_out = sink;
+		strm->avail_out = sizeof(sink);
+		status = inflate(strm, Z_NO_FLUSH);
+
+		uInt produced = static_cast<uInt>(sizeof(sink)) - strm->avail_out;
+		checksum = adler32(checksum, sink, produced);
+		info.inflated_size += produced;
+	}
+
+	// The stream continues directly behind next_in
+	size_t rest = strm->avail_in + in_left;
+	const unsigned char* trailer = strm->next_in;
+
+	if (status == Z_MEM_ERROR) {
+		return ErrorMemory;
+	}
+	if (status != Z_OK && status != Z_STREAM_END) {
+		return ErrorData;
+	}
+	if (info.inflated_size > expected) {
+		return ErrorLength;
+	}
+	if (status != Z_STREAM_END || rest < 4) {
+		return ErrorTruncated;
+	}
+	if (info.inflated_size != expected) {
+		return ErrorLength;
+	}
+
+	uLong stored = (static_cast<uLong>(trailer[0]) << 24) |
+		(static_cast<uLong>(trailer[1]) << 16) |
+		(static_cast<uLong>(trailer[2]) << 8) | trailer[3];
+	if (stored != checksum) {
+		return ErrorChecksum;
+	}
+
+	info.trailing_size = rest - 4;
+	return info.trailing_size > 0 ? ErrorTrailing : Ok;
+}
+
+size_t Xyz::GetEncodeBound(const Header& header) {
+	size_t size = PaletteSize + GetPixelsSize(header);
+	size_t bound = GetDeflateBoundParallel(size);
+	if (GetDeflateBoundZlib(size) > bound) {
+		bound = GetDeflateBoundZlib(size);
+	}
+	if (GetDeflateBoundSplit(GetPixelsSize(header)) > bound) {
+		bound = GetDeflateBoundSplit(GetPixelsSize(header));
+	}
+#ifdef HAVE_LIBDEFLATE
+	if (GetDeflateBoundLibdeflate(size) > bound) {
+		bound = GetDeflateBoundLibdeflate(size);
+	}
+#endif
+#ifdef HAVE_ZLIBNG
+	if (GetDeflateBoundZlibNg(size) > bound) {
+		bound = GetDeflateBoundZlibNg(size);
+	}
+#endif
+	return HeaderSize + bound;
+}
+
+Xyz::Result Xyz::Encode(const Header& header, const unsigned char* palette,
+	const unsigned char* pixels, unsigned char* out, size_t& out_size,
+	int level) {
+	if (out_size < HeaderSize) {
+		return ErrorBufferSize;
+	}
+
+	WriteHeader(header, out);
+
+#ifdef XYZ_BUFFER_BACKENDS
+	Backend backend = GetBackend();
+	if (backend != BackendZlib) {
+		// One contiguous input buffer, the caller's if possible
+		size_t in_size = PaletteSize + GetPixelsSize(header);
+		const unsigned char* in = JoinImage(palette, pixels, in_size);
+
+		size_t written = out_size - HeaderSize;
+		Result result = DeflateBuffer(backend, in, in_size,
+			out + HeaderSize, written, level);
+		out_size = HeaderSize + written;
+		return result;
+	}
+#endif
+
+	int status;
+	z_stream* strm = GetStreamCache().GetDeflate(level, MAX_WBITS, status);
+	if (strm == NULL) {
+		return status == Z_MEM_ERROR ? ErrorMemory : ErrorData;
+	}
+
+	const unsigned char* in = palette;
+	size_t in_left = PaletteSize;
+	bool in_palette = true;
+	unsigned char* dst = out + HeaderSize;
+	size_t dst_left = out_size - HeaderSize;
+	Result result = Ok;
+
+	for (;;) {
+		if (strm->avail_in == 0) {
+			if (in_left == 0 && in_palette) {
+				in_palette = false;
+				in = pixels;
+				in_left = GetPixelsSize(header);
+			}
+			strm->next_in = const_cast<Bytef*>(in);
+			strm->avail_in = GetChunk(in_left);
+			in += strm->avail_in;
+			in_left -= strm->avail_in;
+		}
+
+		if (strm->avail_out == 0) {
+			if (dst_left == 0) {
+				result = ErrorBufferSize;
+				break;
+			}
+			strm->next_out = dst;
+			strm->avail_out = GetChunk(dst_left);
+			dst += strm->avail_out;
+			dst_left -= strm->avail_out;
+		}
+
+		int flush = (!in_palette && in_left == 0) ? Z_FINISH : Z_NO_FLUSH;
+		status = deflate(strm, flush);
+		if (status == Z_STREAM_END) {
+			break;
+		}
+		if (status == Z_STREAM_ERROR) {
+			result = ErrorData;
+			break;
+		}
+	}
+
+	out_size -= dst_left + strm->avail_out;
+
+	return result;
+}
+
+Xyz::Result Xyz::EncodeParallel(const Header& header,
+	const unsigned char* palette, const unsigned char* pixels,
+	unsigned char* out, size_t& out_size, WorkerPool& pool, int level) {
+	size_t in_size = PaletteSize + GetPixelsSize(header);
+	if (in_size <= ParallelBlockSize) {
+		return Encode(header, palette, pixels, out, out_size, level);
+	}
+
+	// Header, zlib header and adler32
+	if (out_size < HeaderSize + 6) {
+		return ErrorBufferSize;
+	}
+
+	const unsigned char* in = JoinImage(palette, pixels, in_size);
+	size_t count = (in_size + ParallelBlockSize - 1) / ParallelBlockSize;
+	std::vector<ParallelBlock> blocks(count);
+
+	// Only the blocks of this image are waited for, the pool is shared
+	std::mutex mutex;
+	std::condition_variable block_done;
+	size_t remaining = count;
+	for (size_t i = 0; i < count; i++) {
+		pool.Submit([in, in_size, count, level, i, &blocks, &mutex,
+			&block_done, &remaining]() {
+			size_t offset = i * ParallelBlockSize;
+			DeflateBlock(in, offset,
+				std::min(ParallelBlockSize, in_size - offset),
+				i == count - 1, level, blocks[i]);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--remaining == 0) {
+				block_done.notify_all();
+			}
+		});
+	}
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		block_done.wait(lock, [&remaining]() { return remaining == 0; });
+	}
+
+	WriteHeader(header, out);
+
+	// zlib header announcing the compression level like deflateInit does
+	int flags = level == Z_DEFAULT_COMPRESSION ? 2 :
+		level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+	out[HeaderSize] = 0x78;
+	out[HeaderSize + 1] = flags << 6;
+	out[HeaderSize + 1] += 31 - (0x7800 + out[HeaderSize + 1]) % 31;
+	size_t written = HeaderSize + 2;
+
+	// The blocks form one deflate stream, their checksums one adler32
+	uLong adler = 1L;
+	for (size_t i = 0; i < count; i++) {
+		ParallelBlock& block = blocks[i];
+		if (block.result != Ok) {
+			return block.result;
+		}
+		// Stored blocks expand, a single stream may still fit
+		if (out_size - written < block.data.size() + 4) {
+			return Encode(header, palette, pixels, out, out_size, level);
+		}
+
+		memcpy(out + written, &block.data.front(), block.data.size());
+		written += block.data.size();
+
+		size_t size = std::min(ParallelBlockSize, in_size - i * ParallelBlockSize);
+		adler = i == 0 ? block.adler :
+			adler32_combine(adler, block.adler, static_cast<z_off_t>(size));
+	}
+
+	out[written] = (adler >> 24) & 0xFF;
+	out[written + 1] = (adler >> 16) & 0xFF;
+	out[written + 2] = (adler >> 8) & 0xFF;
+	out[written + 3] = adler & 0xFF;
+	out_size = written + 4;
+
+	return Ok;
+}
+
+Xyz::Result Xyz::EncodeSplit(const Header& header,
+	const unsigned char* palette, const unsigned char* pixels,
+	unsigned char* out, size_t& out_size, int level) {
+	if (out_size < HeaderSize) {
+		return ErrorBufferSize;
+	}
+
+	WriteHeader(header, out);
+
+	int status;
+	z_stream* strm = GetStreamCache().GetDeflate(level, MAX_WBITS, status);
+	if (strm == NULL) {
+		return status == Z_MEM_ERROR ? ErrorMemory : ErrorData;
+	}
+
+	// The full flush empties the window, the pixels cannot refer back
+	unsigned char* dst = out + HeaderSize;
+	size_t dst_left = out_size - HeaderSize;
+	Result result = DeflateInto(strm, palette, PaletteSize, Z_FULL_FLUSH,
+		dst, dst_left);
+	if (result == Ok) {
+		result = DeflateInto(strm, pixels, GetPixelsSize(header), Z_FINISH,
+			dst, dst_left);
+	}
+
+	out_size -= dst_left;
+	return result;
+}
+
+Xyz::Result Xyz::PatchPalette(const unsigned char* data, size_t size,
+	const unsigned char* palette, std::vector<unsigned char>& out,
+	int level) {
+	Header header;
+	Result result = ReadHeader(data, size, header);
+	if (result != Ok) {
+		return result;
+	}
+
+	const unsigned char* in = data + HeaderSize;
+	size_t in_size = size - HeaderSize;
+	unsigned char old_palette[PaletteSize];
+	size_t offset;
+	result = FindSplit(in, in_size, old_palette, offset);
+	if (result != Ok) {
+		return result;
+	}
+	// At least the last block and the adler32 follow
+	if (in_size - offset < 6) {
+		return ErrorTruncated;
+	}
+
+	// Copying the pixels is only safe if they are independent of the palette
+	size_t pixels_end = in_size - 4;
+	size_t pixels_size = GetPixelsSize(header);
+	uLong pixels_adler;
+	result = InflatePixels(in + offset, pixels_end - offset, pixels_size,
+		pixels_adler);
+	if (result != Ok) {
+		return result;
+	}
+
+	uLong adler = (static_cast<uLong>(in[pixels_end]) << 24) |
+		(in[pixels_end + 1] << 16) | (in[pixels_end + 2] << 8) |
+		in[pixels_end + 3];
+	if (adler != adler32_combine(adler32(1L, old_palette, PaletteSize),
+		pixels_adler, static_cast<z_off_t>(pixels_size))) {
+		return ErrorChecksum;
+	}
+
+	// Deflated on its own up to a new flush point, patchable again
+	int status;
+	z_stream* strm = GetStreamCache().GetDeflate(level, -MAX_WBITS, status);
+	if (strm == NULL) {
+		return status == Z_MEM_ERROR ? ErrorMemory : ErrorData;
+	}
+
+	// Room for the palette stored uncompressed and the flush marker
+	unsigned char segment[PaletteSize + 64];
+	unsigned char* dst = segment;
+	size_t dst_left = sizeof(segment);
+	result = DeflateInto(strm, palette, PaletteSize, Z_FULL_FLUSH,
+		dst, dst_left);
+	if (result != Ok) {
+		return result;
+	}
+	size_t segment_size = dst - segment;
+
+	// The pixels keep their part of the checksum
+	adler = adler32_combine(adler32(1L, palette, PaletteSize), pixels_adler,
+		static_cast<z_off_t>(pixels_size));
+
+	out.resize(HeaderSize + 2 + segment_size + pixels_end - offset + 4);
+	unsigned char* dst_out = &out.front();
+	memcpy(dst_out, data, HeaderSize + 2);
+	memcpy(dst_out + HeaderSize + 2, segment, segment_size);
+	memcpy(dst_out + HeaderSize + 2 + segment_size, in + offset,
+		pixels_end - offset);
+
+	unsigned char* trailer = dst_out + out.size() - 4;
+	trailer[0] = (adler >> 24) & 0xFF;
+	trailer[1] = (adler >> 16) & 0xFF;
+	trailer[2] = (adler >> 8) & 0xFF;
+	trailer[3] = adler & 0xFF;
+
+	return Ok;
+}
+
+Xyz::Decoder::Decoder() : strm(NULL), in(NULL), in_left(0), ended(false) {
+	header.width = 0;
+	header.height = 0;
+}
+
+Xyz::Decoder::~Decoder() {
+	if (strm != NULL) {
+		inflateEnd(strm);
+		delete strm;
+	}
+}
+
+Xyz::Result Xyz::Decoder::Begin(const unsigned char* data, size_t size) {
+	Result result = ReadHeader(data, size, header);
+	if (result != Ok) {
+		return result;
+	}
+
+	if (strm == NULL) {
+		strm = new z_stream;
+		memset(strm, 0, sizeof(*strm));
+		if (inflateInit(strm) != Z_OK) {
+			delete strm;
+			strm = NULL;
+			return ErrorMemory;
+		}
+	} else if (inflateReset(strm) != Z_OK) {
+		return ErrorData;
+	}
+
+	strm->avail_in = 0;
+	in = data + HeaderSize;
+	in_left = size - HeaderSize;
+	ended = false;
+
+	return Ok;
+}
+
+const Xyz::Header& Xyz::Decoder::GetHeader() const {
+	return header;
+}
+
+Xyz::Result Xyz::Decoder::ReadPalette(unsigned char* palette) {
+	return Read(palette, PaletteSize);
+}
+
+Xyz::Result Xyz::Decoder::ReadRow(unsigned char* row) {
+	return Read(row, header.width);
+}
+
+Xyz::Result Xyz::Decoder::Finish() {
+	if (strm == NULL) {
+		return ErrorData;
+	}
+
+	// Anything but the end of the stream would need more output space
+	unsigned char extra;
+	strm->next_out = &extra;
+	strm->avail_out = 1;
+
+	while (!ended) {
+		if (strm->avail_in == 0 && in_left > 0) {
+			strm->next_in = const_cast<Bytef*>(in);
+			strm->avail_in = GetChunk(in_left);
+			in += strm->avail_in;
+			in_left -= strm->avail_in;
+		}
+
+		int status = inflate(strm, Z_NO_FLUSH);
+		if (status == Z_STREAM_END) {
+			ended = true;
+		} else if (status != Z_OK || strm->avail_out == 0) {
+			return status == Z_MEM_ERROR ? ErrorMemory : ErrorData;
+		}
+	}
+
+	return strm->avail_out == 1 ? Ok : ErrorData;
+}
+
+Xyz::Result Xyz::Decoder::Read(unsigned char* out, size_t out_size) {
+	if (strm == NULL) {
+		return ErrorData;
+	}
+
+	while (out_size > 0) {
+		if (ended) {
+			return ErrorData;
+		}
+
+		if (strm->avail_in == 0 && in_left > 0) {
+			strm->next_in = const_cast<Bytef*>(in);
+			strm->avail_in = GetChunk(in_left);
+			in += strm->avail_in;
+			in_left -= strm->avail_in;
+		}
+
+		strm->next_out = out;
+		strm->avail_out = GetChunk(out_size);
+
+		int status = inflate(strm, Z_NO_FLUSH);
+		if (status == Z_STREAM_END) {
+			ended = true;
+		} else if (status != Z_OK) {
+			return status == Z_MEM_ERROR ? ErrorMemory : ErrorData;
+		}
+
+		size_t written = strm->next_out - out;
+		out += written;
+		out_size -= written;
+	}
+
+	return Ok;
+}
+
+Xyz::Encoder::Encoder() : strm(NULL), level(0), out(NULL) {
+	header.width = 0;
+	header.height = 0;
+}
+
+Xyz::Encoder::~Encoder() {
+	if (strm != NULL) {
+		deflateEnd(strm);
+		delete strm;
+	}
+}
+
+Xyz::Result Xyz::Encoder::Begin(const Header& header, std::ostream& out, int level) {
+	if (strm != NULL && this->level != level) {
+		deflateEnd(strm);
+		delete strm;
+		strm = NULL;
+	}
+
+	if (strm == NULL) {
+		strm = new z_stream;
+		memset(strm, 0, sizeof(*strm));
+		int status = deflateInit(strm, level);
+		if (status != Z_OK) {
+			delete strm;
+			strm = NULL;
+			return status == Z_MEM_ERROR ? ErrorMemory : ErrorData;
+		}
+		this->level = level;
+	} else if (deflateReset(strm) != Z_OK) {
+		return ErrorData;
+	}
+
+	this->header = header;
+	this->out = &out;
+	buffer.resize(64 * 1024);
+
+	unsigned char xyz_header[HeaderSize] = {
+		'X', 'Y', 'Z', '1',
+		static_cast<unsigned char>(header.width & 0xFF),
+		static_cast<unsigned char>(header.width >> 8),
+		static_cast<unsigned char>(header.height & 0xFF),
+		static_cast<unsigned char>(header.height >> 8)
+	};
+	out.write(reinterpret_cast<const char*>(xyz_header), HeaderSize);
+
+	return out.good() ? Ok : ErrorData;
+}
+
+Xyz::Result Xyz::Encoder::WritePalette(const unsigned char* palette,
+	bool split) {
+	return Write(palette, PaletteSize, split ? Z_FULL_FLUSH : Z_NO_FLUSH);
+}
+
+Xyz::Result Xyz::Encoder::WriteRow(const unsigned char* row) {
+	return Write(row, header.width, Z_NO_FLUSH);
+}
+
+Xyz::Result Xyz::Encoder::Finish() {
+	return Write(NULL, 0, Z_FINISH);
+}
+
+Xyz::Result Xyz::Encoder::Write(const unsigned char* data, size_t size, int flush) {
+	if (strm == NULL || out == NULL) {
+		return ErrorData;
+	}
+
+	for (;;) {
+		if (strm->avail_in == 0 && size > 0) {
+			strm->next_in = const_cast<Bytef*>(data);
+			strm->avail_in = GetChunk(size);
+			data += strm->avail_in;
+			size -= strm->avail_in;
+		}
+
+		strm->next_out = &buffer.front();
+		strm->avail_out = static_cast<uInt>(buffer.size());
+
+		int status = deflate(strm, size == 0 ? flush : Z_NO_FLUSH);
+		if (status == Z_STREAM_ERROR) {
+			return ErrorData;
+		}
+
+		size_t produced = buffer.size() - strm->avail_out;
+		out->write(reinterpret_cast<const char*>(&buffer.front()), produced);
+		if (!out->good()) {
+			return ErrorData;
+		}
+
+		if (status == Z_STREAM_END) {
+			out->flush();
+			out = NULL;
+			return Ok;
+		}
+
+		// Everything consumed and zlib did not fill the buffer: done
+		if (flush != Z_FINISH && size == 0 && strm->avail_in == 0 &&
+			strm->avail_out != 0) {
+			return Ok;
+		}
+	}
+}
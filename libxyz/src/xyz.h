@@ -0,0 +1,365 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBXYZ_XYZ_H
+#define LIBXYZ_XYZ_H
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+struct z_stream_s;
+
+namespace Xyz {
+	class WorkerPool;
+}
+
+/**
+ * Codec for the RPG Maker 2000/2003 XYZ image format.
+ *
+ * A XYZ file consists of the signature "XYZ1", the image width and height
+ * (16 bit little endian each) and a zlib stream. The stream inflates to a
+ * 256 entry RGB palette (768 bytes) followed by width * height palette
+ * indices.
+ *
+ * All functions work on caller provided memory and never touch the
+ * filesystem.
+ */
+namespace Xyz {
+	/** Size of the signature plus width and height. */
+	const size_t HeaderSize = 8;
+
+	/** Size of the RGB palette in front of the indices. */
+	const size_t PaletteSize = 768;
+
+	/** Result codes of the codec functions. */
+	enum Result {
+		/** Operation succeeded. */
+		Ok = 0,
+		/** Data is shorter than the XYZ header. */
+		ErrorTruncated,
+		/** Data does not start with the XYZ1 signature. */
+		ErrorSignature,
+		/** A caller provided buffer is too small. */
+		ErrorBufferSize,
+		/** The zlib stream is corrupt or does not match the image size. */
+		ErrorData,
+		/** zlib ran out of memory. */
+		ErrorMemory,
+		/** The zlib checksum does not match the inflated data. */
+		ErrorChecksum,
+		/** The zlib stream inflates to more or less than the image size. */
+		ErrorLength,
+		/** There is data behind the end of the zlib stream. */
+		ErrorTrailing,
+		/** The palette does not end in a full flush point, see EncodeSplit. */
+		ErrorNotSplit
+	};
+
+	/**
+	 * Compression libraries for the whole buffer Decode and Encode.
+	 *
+	 * zlib is always available, the others only when found at configure
+	 * time. The incremental Decoder and Encoder always use zlib.
+	 */
+	enum Backend {
+		BackendZlib = 0,
+		BackendZlibNg,
+		BackendLibdeflate
+	};
+
+	/** Image dimensions stored in the XYZ header. */
+	struct Header {
+		unsigned short width;
+		unsigned short height;
+	};
+
+	/** Details gathered by Verify. */
+	struct VerifyInfo {
+		/** Image dimensions, zero when the header is invalid. */
+		Header header;
+		/** Number of bytes inflated before verification stopped. */
+		size_t inflated_size;
+		/** Number of bytes behind the end of the zlib stream. */
+		size_t trailing_size;
+	};
+
+	/** Returns a human readable description of a result code. */
+	const char* GetResultString(Result result);
+
+	/**
+	 * Returns a short identifier of a result code for machine readable
+	 * output ("ok", "truncated", "checksum", ...).
+	 */
+	const char* GetResultName(Result result);
+
+	/** Returns whether a backend was compiled into the library. */
+	bool IsBackendAvailable(Backend backend);
+
+	/** Returns the name of a backend ("zlib", "zlib-ng", "libdeflate"). */
+	const char* GetBackendName(Backend backend);
+
+	/**
+	 * Looks a backend up by its name.
+	 *
+	 * @return whether the name is known and the backend is available
+	 */
+	bool FindBackend(const char* name, Backend& backend);
+
+	/**
+	 * Returns the backend used by Decode and Encode.
+	 *
+	 * Defaults to the fastest available one, the environment variable
+	 * XYZ_BACKEND selects another one by name (e.g. for benchmarking).
+	 */
+	Backend GetBackend();
+
+	/**
+	 * Selects the backend used by Decode and Encode in the whole process.
+	 *
+	 * @return false when the backend is not available
+	 */
+	bool SetBackend(Backend backend);
+
+	/** Returns the number of palette index bytes of an image. */
+	size_t GetPixelsSize(const Header& header);
+
+	/**
+	 * Parses the header of a XYZ file.
+	 *
+	 * @param data start of the XYZ file
+	 * @param size number of bytes available at data
+	 * @param header receives the image dimensions
+	 */
+	Result ReadHeader(const unsigned char* data, size_t size, Header& header);
+
+	/**
+	 * Reads the header and the palette of a XYZ file held in memory.
+	 *
+	 * The palette is at the start of the zlib stream, inflating stops as
+	 * soon as it is complete, so the cost does not depend on the image
+	 * size. The rest of the stream is not checked.
+	 *
+	 * @param data start of the XYZ file
+	 * @param size number of bytes available at data
+	 * @param header receives the image dimensions
+	 * @param palette receives PaletteSize bytes of RGB palette
+	 */
+	Result ReadPalette(const unsigned char* data, size_t size, Header& header,
+		unsigned char* palette);
+
+	/**
+	 * Decodes a complete XYZ file held in memory.
+	 *
+	 * @param data start of the XYZ file
+	 * @param size number of bytes available at data
+	 * @param header receives the image dimensions
+	 * @param palette receives PaletteSize bytes of RGB palette
+	 * @param pixels receives GetPixelsSize(header) palette indices
+	 * @param pixels_size capacity of pixels in bytes
+	 *
+	 * Backends other than zlib inflate into one contiguous buffer, placing
+	 * pixels directly behind the palette avoids a copy for them.
+	 */
+	Result Decode(const unsigned char* data, size_t size, Header& header,
+		unsigned char* palette, unsigned char* pixels, size_t pixels_size);
+
+	/**
+	 * Checks a complete XYZ file held in memory without keeping the image.
+	 *
+	 * The zlib stream is inflated into a small internal buffer. Unlike
+	 * Decode, this also checks the zlib header and the adler32 checksum
+	 * separately and rejects data behind the end of the stream. Inflating
+	 * stops as soon as the stream is longer than the image.
+	 *
+	 * @param data start of the XYZ file
+	 * @param size number of bytes available at data
+	 * @param info receives details about the file
+	 */
+	Result Verify(const unsigned char* data, size_t size, VerifyInfo& info);
+
+	/**
+	 * Returns the maximum size of an encoded XYZ file, including header,
+	 * for any of the available backends, EncodeParallel and EncodeSplit.
+	 */
+	size_t GetEncodeBound(const Header& header);
+
+	/**
+	 * Encodes an image into a complete XYZ file held in memory.
+	 *
+	 * @param header image dimensions
+	 * @param palette PaletteSize bytes of RGB palette
+	 * @param pixels GetPixelsSize(header) palette indices, rows top to bottom
+	 * @param out receives the XYZ file
+	 * @param out_size capacity of out, receives the written size
+	 * @param level compression level, 0 to 9 (libdeflate: up to 12)
+	 *
+	 * Backends other than zlib deflate from one contiguous buffer, placing
+	 * pixels directly behind the palette avoids a copy for them.
+	 */
+	Result Encode(const Header& header, const unsigned char* palette,
+		const unsigned char* pixels, unsigned char* out, size_t& out_size,
+		int level = 9);
+
+	/**
+	 * Encodes an image like Encode, deflating it in blocks on several
+	 * threads.
+	 *
+	 * Every block is primed with the end of the previous one as
+	 * dictionary and ends on a byte boundary, the blocks are joined into
+	 * a single regular zlib stream with a combined adler32. The output
+	 * does not depend on the number of threads and is only slightly
+	 * larger than the one of Encode. Blocks are always deflated by zlib,
+	 * images that fit into one block are passed to Encode, as are images
+	 * whose blocks do not fit into out.
+	 *
+	 * @param pool deflates the blocks, it may be shared by several
+	 *             threads calling EncodeParallel, but must not be the pool
+	 *             running the caller
+	 */
+	Result EncodeParallel(const Header& header, const unsigned char* palette,
+		const unsigned char* pixels, unsigned char* out, size_t& out_size,
+		WorkerPool& pool, int level = 9);
+
+	/**
+	 * Encodes an image like Encode, ending the palette in a full flush
+	 * point.
+	 *
+	 * The pixels are deflated without references to the palette, so
+	 * PatchPalette can replace the palette without compressing them
+	 * again. The flush point costs a few bytes. Always deflated by zlib.
+	 */
+	Result EncodeSplit(const Header& header, const unsigned char* palette,
+		const unsigned char* pixels, unsigned char* out, size_t& out_size,
+		int level = 9);
+
+	/**
+	 * Replaces the palette of a XYZ file written by EncodeSplit.
+	 *
+	 * Only the palette is deflated again, the compressed pixels are
+	 * copied unchanged and the adler32 is derived from the old one. The
+	 * pixels are inflated once to check the stream and that they do not
+	 * refer back into the palette, streams ending the palette in a sync
+	 * flush instead of a full flush give ErrorNotSplit. The result can be
+	 * patched again.
+	 *
+	 * @param data start of the XYZ file
+	 * @param size number of bytes available at data
+	 * @param palette PaletteSize bytes of the new RGB palette
+	 * @param out receives the new XYZ file
+	 * @param level compression level of the palette
+	 */
+	Result PatchPalette(const unsigned char* data, size_t size,
+		const unsigned char* palette, std::vector<unsigned char>& out,
+		int level = 9);
+
+	/**
+	 * Incremental decoder that inflates a XYZ file piece by piece.
+	 *
+	 * Only the zlib window and the caller buffers are needed, no matter
+	 * how large the image is. The zlib state is kept and reset when the
+	 * decoder is reused for another file.
+	 */
+	class Decoder {
+	public:
+		Decoder();
+		~Decoder();
+
+		/**
+		 * Starts decoding a XYZ file and parses its header.
+		 *
+		 * @param data start of the XYZ file, must stay valid while decoding
+		 * @param size number of bytes available at data
+		 */
+		Result Begin(const unsigned char* data, size_t size);
+
+		/** Returns the header parsed by Begin. */
+		const Header& GetHeader() const;
+
+		/** Inflates the palette, must be called first after Begin. */
+		Result ReadPalette(unsigned char* palette);
+
+		/** Inflates the next row of header.width palette indices. */
+		Result ReadRow(unsigned char* row);
+
+		/** Checks that the stream ends after the last row. */
+		Result Finish();
+
+	private:
+		Decoder(const Decoder&);
+		Decoder& operator=(const Decoder&);
+
+		Result Read(unsigned char* out, size_t out_size);
+
+		z_stream_s* strm;
+		Header header;
+		const unsigned char* in;
+		size_t in_left;
+		bool ended;
+	};
+
+	/**
+	 * Incremental encoder that deflates a XYZ file piece by piece into an
+	 * output stream.
+	 *
+	 * Only the zlib state and a small output buffer are kept, the caller
+	 * can release every row after passing it in. The zlib state is reset
+	 * when the encoder is reused for another file.
+	 */
+	class Encoder {
+	public:
+		Encoder();
+		~Encoder();
+
+		/**
+		 * Writes the XYZ header and starts a new zlib stream.
+		 *
+		 * @param header image dimensions
+		 * @param out receives the XYZ file, must stay valid while encoding
+		 * @param level zlib compression level
+		 */
+		Result Begin(const Header& header, std::ostream& out, int level = 9);
+
+		/**
+		 * Deflates the palette, must be called first after Begin.
+		 *
+		 * @param split end the palette in a full flush point like
+		 *              EncodeSplit
+		 */
+		Result WritePalette(const unsigned char* palette, bool split = false);
+
+		/** Deflates the next row of header.width palette indices. */
+		Result WriteRow(const unsigned char* row);
+
+		/** Ends the zlib stream and flushes all pending output. */
+		Result Finish();
+
+	private:
+		Encoder(const Encoder&);
+		Encoder& operator=(const Encoder&);
+
+		Result Write(const unsigned char* data, size_t size, int flush);
+
+		z_stream_s* strm;
+		int level;
+		Header header;
+		std::ostream* out;
+		std::vector<unsigned char> buffer;
+	};
+}
+
+#endif
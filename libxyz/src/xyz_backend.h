@@ -0,0 +1,56 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBXYZ_XYZ_BACKEND_H
+#define LIBXYZ_XYZ_BACKEND_H
+
+#include "xyz.h"
+
+/*
+ * Whole buffer zlib stream functions of the optional backends. They live
+ * in their own translation units because zlib-ng and zlib define the same
+ * macros. Not installed, internal to libxyz.
+ */
+namespace Xyz {
+#ifdef HAVE_LIBDEFLATE
+	/** Inflates exactly out_size bytes from a zlib stream. */
+	Result InflateLibdeflate(const unsigned char* in, size_t in_size,
+		unsigned char* out, size_t out_size);
+
+	/** Deflates into a zlib stream, out_size receives the written size. */
+	Result DeflateLibdeflate(const unsigned char* in, size_t in_size,
+		unsigned char* out, size_t& out_size, int level);
+
+	/** Returns the maximum zlib stream size for in_size input bytes. */
+	size_t GetDeflateBoundLibdeflate(size_t in_size);
+#endif
+
+#ifdef HAVE_ZLIBNG
+	/** Inflates exactly out_size bytes from a zlib stream. */
+	Result InflateZlibNg(const unsigned char* in, size_t in_size,
+		unsigned char* out, size_t out_size);
+
+	/** Deflates into a zlib stream, out_size receives the written size. */
+	Result DeflateZlibNg(const unsigned char* in, size_t in_size,
+		unsigned char* out, size_t& out_size, int level);
+
+	/** Returns the maximum zlib stream size for in_size input bytes. */
+	size_t GetDeflateBoundZlibNg(size_t in_size);
+#endif
+}
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "xyz_dir.h"
+#include <cctype>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+# include <direct.h>
+# include "dirent_win.h"
+# ifndef S_ISDIR
+#  define S_ISDIR(mode) (((mode) & S_IFMT) == S_IFDIR)
+# endif
+# ifndef S_ISREG
+#  define S_ISREG(mode) (((mode) & S_IFMT) == S_IFREG)
+# endif
+#else
+# include <dirent.h>
+#endif
+
+namespace {
+	/** Returns whether name ends with extension, ignoring case. */
+	bool HasExtension(const std::string& name, const std::string& extension) {
+		if (name.size() <= extension.size()) {
+			return false;
+		}
+
+		size_t offset = name.size() - extension.size();
+		for (size_t i = 0; i < extension.size(); i++) {
+			if (tolower(static_cast<unsigned char>(name[offset + i])) !=
+				tolower(static_cast<unsigned char>(extension[i]))) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/** Returns whether path is an existing directory. */
+	bool IsDirectory(const std::string& path) {
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+	}
+
+	bool Walk(const std::string& root, const std::string& relative,
+		const std::string& extension,
+		const std::function<void(const std::string&)>& found) {
+		std::string path = relative.empty() ? root : root + "/" + relative;
+		DIR* dir = opendir(path.c_str());
+		if (dir == NULL) {
+			return false;
+		}
+
+		bool success = true;
+		struct dirent* entry;
+		while ((entry = readdir(dir)) != NULL) {
+			std::string name = entry->d_name;
+			if (name == "." || name == "..") {
+				continue;
+			}
+
+			std::string entry_relative = relative.empty() ? name :
+				relative + "/" + name;
+			int type = entry->d_type;
+
+			if (type != DT_DIR && type != DT_REG) {
+				// Unknown to the filesystem or a link, do not follow
+				// links to directories to avoid cycles
+				struct stat st;
+				std::string entry_path = path + "/" + name;
+#ifdef _WIN32
+				int result = stat(entry_path.c_str(), &st);
+#else
+				int result = lstat(entry_path.c_str(), &st);
+				if (result == 0 && S_ISLNK(st.st_mode)) {
+					result = stat(entry_path.c_str(), &st);
+					if (result == 0 && S_ISDIR(st.st_mode)) {
+						continue;
+					}
+				}
+#endif
+				if (result != 0) {
+					continue;
+				}
+				type = S_ISDIR(st.st_mode) ? DT_DIR :
+					S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+			}
+
+			if (type == DT_DIR) {
+				if (!Walk(root, entry_relative, extension, found)) {
+					success = false;
+				}
+			} else if (type == DT_REG && HasExtension(name, extension)) {
+				found(entry_relative);
+			}
+		}
+
+		closedir(dir);
+		return success;
+	}
+}
+
+bool Xyz::WalkDirectory(const std::string& root, const std::string& extension,
+	const std::function<void(const std::string&)>& found) {
+	return Walk(root, "", extension, found);
+}
+
+bool Xyz::CreateDirectories(const std::string& path) {
+	if (path.empty() || IsDirectory(path)) {
+		return true;
+	}
+
+	size_t separator = path.find_last_of("/\\");
+	if (separator != std::string::npos && separator > 0 &&
+		!CreateDirectories(path.substr(0, separator))) {
+		return false;
+	}
+
+#ifdef _WIN32
+	int result = _mkdir(path.c_str());
+#else
+	int result = mkdir(path.c_str(), 0777);
+#endif
+	// Another thread may have been faster
+	return result == 0 || (errno == EEXIST && IsDirectory(path));
+}
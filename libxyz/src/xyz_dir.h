@@ -0,0 +1,53 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBXYZ_XYZ_DIR_H
+#define LIBXYZ_XYZ_DIR_H
+
+#include <functional>
+#include <string>
+
+namespace Xyz {
+	/**
+	 * Walks a directory tree depth first and reports every regular file
+	 * with a matching extension as soon as it is found, so conversions can
+	 * start while the tree is still being walked.
+	 *
+	 * Symbolic links to directories are not followed.
+	 *
+	 * @param root directory to walk
+	 * @param extension extension including the dot, compared ignoring case,
+	 *                  empty to report all files
+	 * @param found receives the path of each file relative to root, with /
+	 *              as separator
+	 * @return false when root or one of its subdirectories could not be
+	 *         read, the other directories are walked anyway
+	 */
+	bool WalkDirectory(const std::string& root, const std::string& extension,
+		const std::function<void(const std::string&)>& found);
+
+	/**
+	 * Creates a directory and all missing parents. Existing directories
+	 * are fine, so several threads can create the same path.
+	 *
+	 * @param path directory to create
+	 * @return whether the directory exists afterwards
+	 */
+	bool CreateDirectories(const std::string& path);
+}
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "xyz_file.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#ifdef _WIN32
+# include <windows.h>
+# include <fcntl.h>
+# include <io.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+namespace {
+	/** Maps a regular file, returns NULL when this is not possible. */
+	const unsigned char* MapFile(const std::string& filename, size_t& size) {
+#ifdef _WIN32
+		HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ,
+			FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			return NULL;
+		}
+
+		LARGE_INTEGER file_size;
+		if (GetFileType(file) != FILE_TYPE_DISK ||
+			!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0 ||
+			static_cast<unsigned long long>(file_size.QuadPart) > static_cast<size_t>(-1)) {
+			CloseHandle(file);
+			return NULL;
+		}
+
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(file);
+		if (mapping == NULL) {
+			return NULL;
+		}
+
+		void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		if (view == NULL) {
+			return NULL;
+		}
+
+		size = static_cast<size_t>(file_size.QuadPart);
+		return static_cast<const unsigned char*>(view);
+#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return NULL;
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+			static_cast<unsigned long long>(st.st_size) > static_cast<size_t>(-1)) {
+			close(fd);
+			return NULL;
+		}
+
+		void* view = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (view == MAP_FAILED) {
+			return NULL;
+		}
+
+		size = static_cast<size_t>(st.st_size);
+		return static_cast<const unsigned char*>(view);
+#endif
+	}
+
+	void UnmapFile(const unsigned char* data, size_t size) {
+#ifdef _WIN32
+		(void) size;
+		UnmapViewOfFile(data);
+#else
+		munmap(const_cast<unsigned char*>(data), size);
+#endif
+	}
+}
+
+bool Xyz::ReplaceFile(const std::string& filename, const unsigned char* data,
+	size_t size) {
+	std::string temp_filename = filename + ".tmp";
+	FILE* file = fopen(temp_filename.c_str(), "wb");
+	if (file == NULL) {
+		return false;
+	}
+
+	bool written = fwrite(data, 1, size, file) == size;
+	if (fclose(file) != 0 || !written) {
+		remove(temp_filename.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	// rename does not replace existing files on Windows
+	remove(filename.c_str());
+#endif
+	if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+		remove(temp_filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+std::vector<std::string> Xyz::SplitFields(const std::string& line) {
+	std::vector<std::string> fields;
+	size_t start = 0;
+	size_t end;
+	while ((end = line.find('\t', start)) != std::string::npos) {
+		fields.push_back(line.substr(start, end - start));
+		start = end + 1;
+	}
+	fields.push_back(line.substr(start));
+	return fields;
+}
+
+bool Xyz::ParseNumber(const std::string& str, int base,
+	unsigned long long& value) {
+	// strtoull would accept whitespace and a sign
+	if (str.empty() || !isxdigit(static_cast<unsigned char>(str[0]))) {
+		return false;
+	}
+	char* end;
+	value = strtoull(str.c_str(), &end, base);
+	return *end == '\0';
+}
+
+void Xyz::SetBinaryMode(FILE* file) {
+#ifdef _WIN32
+	_setmode(_fileno(file), _O_BINARY);
+#else
+	(void) file;
+#endif
+}
+
+Xyz::InputFile::InputFile() : data(NULL), size(0), mapped(false) {
+}
+
+Xyz::InputFile::~InputFile() {
+	Close();
+}
+
+bool Xyz::InputFile::Open(const std::string& filename) {
+	Close();
+
+	data = MapFile(filename, size);
+	if (data != NULL) {
+		mapped = true;
+		return true;
+	}
+
+	// Not mappable (pipe, empty file, ...), read it the classic way
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (file == NULL) {
+		return false;
+	}
+
+	bool success = ReadStream(file);
+	fclose(file);
+	return success;
+}
+
+bool Xyz::InputFile::OpenStdin() {
+	Close();
+
+	SetBinaryMode(stdin);
+	return ReadStream(stdin);
+}
+
+bool Xyz::InputFile::ReadStream(FILE* file) {
+	size_t chunk = 64 * 1024;
+	size_t read;
+	do {
+		buffer.resize(size + chunk);
+		read = fread(&buffer[size], 1, chunk, file);
+		size += read;
+	} while (read == chunk);
+
+	bool success = ferror(file) == 0;
+
+	buffer.resize(size);
+	data = buffer.empty() ? NULL : &buffer.front();
+
+	if (!success) {
+		Close();
+	}
+	return success;
+}
+
+void Xyz::InputFile::Close() {
+	if (mapped) {
+		UnmapFile(data, size);
+	}
+
+	// Keep the capacity, the next Open of a pipe reuses it
+	buffer.clear();
+	data = NULL;
+	size = 0;
+	mapped = false;
+}
+
+const unsigned char* Xyz::InputFile::GetData() const {
+	return data;
+}
+
+size_t Xyz::InputFile::GetSize() const {
+	return size;
+}
+
+bool Xyz::InputFile::IsMapped() const {
+	return mapped;
+}
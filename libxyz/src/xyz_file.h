@@ -0,0 +1,123 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBXYZ_XYZ_FILE_H
+#define LIBXYZ_XYZ_FILE_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace Xyz {
+	/**
+	 * Writes a whole file through a temporary file next to it, which is
+	 * renamed over the old one at the end, so an interrupted write never
+	 * leaves a truncated file behind.
+	 *
+	 * @param filename path of the file
+	 * @param data new file contents
+	 * @param size size of the file contents
+	 * @return whether the file was written and replaced
+	 */
+	bool ReplaceFile(const std::string& filename, const unsigned char* data,
+		size_t size);
+
+	/**
+	 * Splits a line of a tab separated text file into its fields.
+	 *
+	 * @param line line without the line break
+	 * @return fields, at least one
+	 */
+	std::vector<std::string> SplitFields(const std::string& line);
+
+	/**
+	 * Parses an unsigned number.
+	 *
+	 * @param str number without sign or whitespace
+	 * @param base 10 or 16
+	 * @param value parsed number
+	 * @return false when str is empty or has trailing garbage
+	 */
+	bool ParseNumber(const std::string& str, int base,
+		unsigned long long& value);
+
+	/**
+	 * Switches stdin or stdout to binary mode, so image data is not
+	 * mangled by newline conversion. Only needed on Windows.
+	 */
+	void SetBinaryMode(FILE* file);
+
+	/**
+	 * Read only view of a whole input file.
+	 *
+	 * Regular files are memory mapped, so the codec reads straight from
+	 * the page cache. Pipes, devices and files that cannot be mapped are
+	 * read into an internal buffer instead.
+	 */
+	class InputFile {
+	public:
+		InputFile();
+
+		/** Unmaps or frees the file contents. */
+		~InputFile();
+
+		/**
+		 * Opens a file, closing any previously opened one.
+		 *
+		 * @param filename path of the file
+		 * @return whether the file could be read
+		 */
+		bool Open(const std::string& filename);
+
+		/**
+		 * Reads standard input until its end, closing any previously
+		 * opened file.
+		 *
+		 * @return whether standard input could be read
+		 */
+		bool OpenStdin();
+
+		/**
+		 * Releases the file contents. The read buffer keeps its capacity,
+		 * so an InputFile opened again for another pipe does not allocate.
+		 */
+		void Close();
+
+		/** Returns the file contents, valid until Close. */
+		const unsigned char* GetData() const;
+
+		/** Returns the size of the file contents. */
+		size_t GetSize() const;
+
+		/** Returns whether the contents are memory mapped. */
+		bool IsMapped() const;
+
+	private:
+		InputFile(const InputFile&);
+		InputFile& operator=(const InputFile&);
+
+		bool ReadStream(FILE* file);
+
+		const unsigned char* data;
+		size_t size;
+		bool mapped;
+		std::vector<unsigned char> buffer;
+	};
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_LIBDEFLATE
+
+#include "xyz_backend.h"
+#include <libdeflate.h>
+
+namespace {
+	/** Per thread libdeflate state, allocated on first use. */
+	struct LibdeflateState {
+		libdeflate_decompressor* decompressor;
+		libdeflate_compressor* compressor;
+		int level;
+
+		LibdeflateState() : decompressor(NULL), compressor(NULL), level(-1) {
+		}
+
+		~LibdeflateState() {
+			if (decompressor != NULL) {
+				libdeflate_free_decompressor(decompressor);
+			}
+			if (compressor != NULL) {
+				libdeflate_free_compressor(compressor);
+			}
+		}
+	};
+
+	thread_local LibdeflateState state;
+}
+
+Xyz::Result Xyz::InflateLibdeflate(const unsigned char* in, size_t in_size,
+	unsigned char* out, size_t out_size) {
+	if (state.decompressor == NULL) {
+		state.decompressor = libdeflate_alloc_decompressor();
+		if (state.decompressor == NULL) {
+			return ErrorMemory;
+		}
+	}
+
+	// Without an actual size pointer the output must be filled exactly
+	libdeflate_result status = libdeflate_zlib_decompress(state.decompressor,
+		in, in_size, out, out_size, NULL);
+
+	return status == LIBDEFLATE_SUCCESS ? Ok : ErrorData;
+}
+
+Xyz::Result Xyz::DeflateLibdeflate(const unsigned char* in, size_t in_size,
+	unsigned char* out, size_t& out_size, int level) {
+	if (state.compressor == NULL || state.level != level) {
+		if (state.compressor != NULL) {
+			libdeflate_free_compressor(state.compressor);
+		}
+		state.compressor = libdeflate_alloc_compressor(level);
+		state.level = level;
+		if (state.compressor == NULL) {
+			return ErrorMemory;
+		}
+	}
+
+	size_t written = libdeflate_zlib_compress(state.compressor,
+		in, in_size, out, out_size);
+	if (written == 0) {
+		return ErrorBufferSize;
+	}
+
+	out_size = written;
+	return Ok;
+}
+
+size_t Xyz::GetDeflateBoundLibdeflate(size_t in_size) {
+	// Without a compressor the bound holds for all compression levels
+	return libdeflate_zlib_compress_bound(NULL, in_size);
+}
+
+#endif
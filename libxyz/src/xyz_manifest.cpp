@@ -0,0 +1,291 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "xyz_manifest.h"
+#include "xyz_file.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace {
+	const char* const signature = "XYZMANIFEST 1";
+
+	/** Reads size and modification time of a file. */
+	bool GetFileInfo(const std::string& filename, unsigned long long& size,
+		long long& mtime) {
+#ifdef _WIN32
+		struct _stat64 st;
+		if (_stat64(filename.c_str(), &st) != 0) {
+			return false;
+		}
+#else
+		struct stat st;
+		if (stat(filename.c_str(), &st) != 0) {
+			return false;
+		}
+#endif
+		size = static_cast<unsigned long long>(st.st_size);
+		mtime = static_cast<long long>(st.st_mtime);
+		return true;
+	}
+
+	/** Reads the state of a file, including its hash. */
+	bool GetFileState(const std::string& filename, Xyz::FileState& state) {
+		if (!GetFileInfo(filename, state.size, state.mtime)) {
+			return false;
+		}
+
+		Xyz::InputFile file;
+		if (!file.Open(filename)) {
+			return false;
+		}
+		state.size = file.GetSize();
+		state.hash = Xyz::Hash(file.GetData(), file.GetSize());
+		return true;
+	}
+
+	/**
+	 * Compares a file with its recorded state. The contents are only
+	 * hashed when the size matches but the modification time does not.
+	 */
+	bool IsUnchanged(const std::string& filename,
+		const Xyz::FileState& recorded, Xyz::FileState& state) {
+		if (!GetFileInfo(filename, state.size, state.mtime) ||
+			state.size != recorded.size) {
+			return false;
+		}
+
+		if (state.mtime == recorded.mtime) {
+			state.hash = recorded.hash;
+			return true;
+		}
+
+		return GetFileState(filename, state) && state.size == recorded.size &&
+			state.hash == recorded.hash;
+	}
+
+	/** Escapes tabs, line breaks and backslashes of a field. */
+	std::string Escape(const std::string& field) {
+		std::string escaped;
+		for (size_t i = 0; i < field.size(); i++) {
+			switch (field[i]) {
+				case '\t':
+					escaped += "\\t";
+					break;
+				case '\n':
+					escaped += "\\n";
+					break;
+				case '\r':
+					escaped += "\\r";
+					break;
+				case '\\':
+					escaped += "\\\\";
+					break;
+				default:
+					escaped += field[i];
+			}
+		}
+		return escaped;
+	}
+
+	/** Reverts Escape, returns false on unknown escapes. */
+	bool Unescape(const std::string& field, std::string& value) {
+		value.clear();
+		for (size_t i = 0; i < field.size(); i++) {
+			if (field[i] != '\\') {
+				value += field[i];
+				continue;
+			}
+			if (++i == field.size()) {
+				return false;
+			}
+			switch (field[i]) {
+				case 't':
+					value += '\t';
+					break;
+				case 'n':
+					value += '\n';
+					break;
+				case 'r':
+					value += '\r';
+					break;
+				case '\\':
+					value += '\\';
+					break;
+				default:
+					return false;
+			}
+		}
+		return true;
+	}
+
+	/** Parses size, modification time and hash of a file. */
+	bool ParseState(const std::string& size, const std::string& mtime,
+		const std::string& hash, Xyz::FileState& state) {
+		unsigned long long time;
+		bool negative = !mtime.empty() && mtime[0] == '-';
+		if (!Xyz::ParseNumber(size, 10, state.size) ||
+			!Xyz::ParseNumber(mtime.substr(negative ? 1 : 0), 10, time) ||
+			!Xyz::ParseNumber(hash, 16, state.hash)) {
+			return false;
+		}
+		state.mtime = negative ? -static_cast<long long>(time) :
+			static_cast<long long>(time);
+		return true;
+	}
+
+	/** Writes size, modification time and hash of a file. */
+	void WriteState(std::ostream& out, const Xyz::FileState& state) {
+		out << state.size << '\t' << state.mtime << '\t'
+			<< std::hex << state.hash << std::dec;
+	}
+}
+
+unsigned long long Xyz::Hash(const unsigned char* data, size_t size) {
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+Xyz::Manifest::Manifest() {
+}
+
+bool Xyz::Manifest::Load(const std::string& filename) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in) {
+		// Nothing converted yet
+		FILE* file = fopen(filename.c_str(), "rb");
+		if (file != NULL) {
+			fclose(file);
+			return false;
+		}
+		return true;
+	}
+
+	std::string line;
+	if (!std::getline(in, line) || line != signature) {
+		return false;
+	}
+
+	std::map<std::string, Entry> loaded;
+	while (std::getline(in, line)) {
+		std::vector<std::string> fields = Xyz::SplitFields(line);
+		Entry entry;
+		std::string input;
+		if (fields.size() != 9 || !Unescape(fields[0], input) ||
+			!Unescape(fields[1], entry.output) ||
+			!Unescape(fields[2], entry.settings) ||
+			!ParseState(fields[3], fields[4], fields[5], entry.input_state) ||
+			!ParseState(fields[6], fields[7], fields[8], entry.output_state)) {
+			return false;
+		}
+		loaded[input] = entry;
+	}
+
+	if (in.bad()) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	entries.swap(loaded);
+	return true;
+}
+
+bool Xyz::Manifest::Save(const std::string& filename) const {
+	std::ostringstream out;
+	out << signature << '\n';
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<std::string, Entry>::const_iterator it;
+		for (it = entries.begin(); it != entries.end(); ++it) {
+			out << Escape(it->first) << '\t' << Escape(it->second.output)
+				<< '\t' << Escape(it->second.settings) << '\t';
+			WriteState(out, it->second.input_state);
+			out << '\t';
+			WriteState(out, it->second.output_state);
+			out << '\n';
+		}
+	}
+
+	std::string contents = out.str();
+	return Xyz::ReplaceFile(filename,
+		reinterpret_cast<const unsigned char*>(contents.data()),
+		contents.size());
+}
+
+bool Xyz::Manifest::IsUpToDate(const std::string& input,
+	const std::string& output, const std::string& settings) {
+	Entry entry;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<std::string, Entry>::const_iterator it = entries.find(input);
+		if (it == entries.end()) {
+			return false;
+		}
+		entry = it->second;
+	}
+
+	if (entry.output != output || entry.settings != settings) {
+		return false;
+	}
+
+	FileState input_state;
+	FileState output_state;
+	if (!IsUnchanged(input, entry.input_state, input_state) ||
+		!IsUnchanged(output, entry.output_state, output_state)) {
+		return false;
+	}
+
+	// Remember new timestamps, so the next run does not hash again
+	if (input_state.mtime != entry.input_state.mtime ||
+		output_state.mtime != entry.output_state.mtime) {
+		entry.input_state = input_state;
+		entry.output_state = output_state;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		entries[input] = entry;
+	}
+
+	return true;
+}
+
+bool Xyz::Manifest::Update(const std::string& input,
+	const std::string& output, const std::string& settings,
+	unsigned long long input_hash, unsigned long long input_size) {
+	Entry entry;
+	entry.output = output;
+	entry.settings = settings;
+	entry.input_state.hash = input_hash;
+
+	if (!GetFileInfo(input, entry.input_state.size,
+		entry.input_state.mtime) || entry.input_state.size != input_size ||
+		!GetFileState(output, entry.output_state)) {
+		std::lock_guard<std::mutex> lock(mutex);
+		entries.erase(input);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	entries[input] = entry;
+	return true;
+}
@@ -0,0 +1,117 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBXYZ_XYZ_MANIFEST_H
+#define LIBXYZ_XYZ_MANIFEST_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace Xyz {
+	/** Size, modification time and content hash of a file. */
+	struct FileState {
+		unsigned long long size;
+		long long mtime;
+		unsigned long long hash;
+	};
+
+	/** Returns the 64 bit FNV-1a hash of a buffer. */
+	unsigned long long Hash(const unsigned char* data, size_t size);
+
+	/**
+	 * Record of previous conversions used to skip files whose outputs are
+	 * up to date.
+	 *
+	 * For every input file the manifest stores the state of the input and
+	 * the output file and the conversion settings. A file is up to date
+	 * when the input and the output are unchanged and the settings match.
+	 * Unchanged sizes and modification times are trusted, otherwise the
+	 * contents are hashed, so fresh checkouts with new timestamps are
+	 * still recognized as unchanged.
+	 *
+	 * The manifest is a text file with one tab separated line per input.
+	 * Tabs, line breaks and backslashes in paths and settings are escaped
+	 * with a backslash. All methods may be called from several threads at
+	 * once.
+	 */
+	class Manifest {
+	public:
+		Manifest();
+
+		/**
+		 * Reads a manifest file, a missing file gives an empty manifest.
+		 *
+		 * @param filename path of the manifest
+		 * @return false when the file exists but cannot be read or parsed
+		 */
+		bool Load(const std::string& filename);
+
+		/**
+		 * Writes the manifest file, replacing it atomically when possible.
+		 *
+		 * @param filename path of the manifest
+		 * @return whether the file could be written
+		 */
+		bool Save(const std::string& filename) const;
+
+		/**
+		 * Returns whether output was converted from the current contents of
+		 * input with the same settings and was not modified since.
+		 *
+		 * @param input path of the input file
+		 * @param output path of the output file
+		 * @param settings conversion settings that influence the output
+		 */
+		bool IsUpToDate(const std::string& input, const std::string& output,
+			const std::string& settings);
+
+		/**
+		 * Records a successful conversion.
+		 *
+		 * The input is described by the contents that were converted, a
+		 * file that changed in the meantime is not recorded.
+		 *
+		 * @param input path of the input file
+		 * @param output path of the output file
+		 * @param settings conversion settings that influence the output
+		 * @param input_hash hash of the converted input contents
+		 * @param input_size size of the converted input contents
+		 * @return false when the output cannot be read or the input changed
+		 */
+		bool Update(const std::string& input, const std::string& output,
+			const std::string& settings, unsigned long long input_hash,
+			unsigned long long input_size);
+
+	private:
+		Manifest(const Manifest&);
+		Manifest& operator=(const Manifest&);
+
+		struct Entry {
+			std::string output;
+			std::string settings;
+			FileState input_state;
+			FileState output_state;
+		};
+
+		mutable std::mutex mutex;
+		std::map<std::string, Entry> entries;
+	};
+}
+
+#endif
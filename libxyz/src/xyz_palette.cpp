@@ -0,0 +1,81 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "xyz_palette.h"
+#include "xyz.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+size_t Xyz::OptimizePalette(unsigned char* palette, unsigned char* pixels,
+	size_t pixels_size) {
+	size_t counts[256] = { 0 };
+	for (size_t i = 0; i < pixels_size; i++) {
+		counts[pixels[i]]++;
+	}
+
+	// Used duplicates are merged into the first entry of their color,
+	// but never into index 0, as only that one is transparent
+	int merged[256];
+	for (int i = 0; i < 256; i++) {
+		merged[i] = i;
+		if (i == 0 || counts[i] == 0) {
+			continue;
+		}
+		for (int j = 1; j < i; j++) {
+			if (counts[j] > 0 && merged[j] == j
+				&& memcmp(&palette[i * 3], &palette[j * 3], 3) == 0) {
+				merged[i] = j;
+				counts[j] += counts[i];
+				counts[i] = 0;
+				break;
+			}
+		}
+	}
+
+	std::vector<int> order;
+	for (int i = 1; i < 256; i++) {
+		if (counts[i] > 0) {
+			order.push_back(i);
+		}
+	}
+	// Equally frequent colors are ordered by RGB value, merged colors are
+	// unique, so the order does not depend on the original one
+	std::sort(order.begin(), order.end(), [&](int a, int b) {
+		if (counts[a] != counts[b]) {
+			return counts[a] > counts[b];
+		}
+		return memcmp(&palette[a * 3], &palette[b * 3], 3) < 0;
+	});
+
+	unsigned char optimized[PaletteSize] = { 0 };
+	unsigned char map[256] = { 0 };
+	memcpy(optimized, palette, 3);
+	for (size_t i = 0; i < order.size(); i++) {
+		map[order[i]] = static_cast<unsigned char>(i + 1);
+		memcpy(&optimized[(i + 1) * 3], &palette[order[i] * 3], 3);
+	}
+	for (int i = 1; i < 256; i++) {
+		map[i] = map[merged[i]];
+	}
+
+	for (size_t i = 0; i < pixels_size; i++) {
+		pixels[i] = map[pixels[i]];
+	}
+	memcpy(palette, optimized, PaletteSize);
+	return order.size() + 1;
+}
@@ -0,0 +1,44 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBXYZ_XYZ_PALETTE_H
+#define LIBXYZ_XYZ_PALETTE_H
+
+#include <cstddef>
+
+namespace Xyz {
+	/**
+	 * Rewrites palette and pixels of an image into a canonical form that
+	 * compresses better, without changing the color of any pixel.
+	 *
+	 * Palette index 0 is the transparent color and keeps its place and
+	 * color. Other entries with the same color are merged, the used ones
+	 * are moved to indices 1 and up, the most frequent first and equally
+	 * frequent ones by RGB value, and unused entries are set to black.
+	 * Images that differ only in palette order, duplicate colors or unused
+	 * entries give the same result.
+	 *
+	 * @param palette PaletteSize bytes of RGB palette
+	 * @param pixels palette indices
+	 * @param pixels_size number of palette indices
+	 * @return number of used palette entries, including index 0
+	 */
+	size_t OptimizePalette(unsigned char* palette, unsigned char* pixels,
+		size_t pixels_size);
+}
+
+#endif
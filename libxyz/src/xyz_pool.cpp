@@ -0,0 +1,110 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "xyz_pool.h"
+#include <cstdlib>
+
+Xyz::WorkerPool::WorkerPool(unsigned count) :
+	size(count == 0 ? GetDefaultSize() : count), active(0), stopping(false) {
+	if (size > 1) {
+		for (unsigned i = 0; i < size; i++) {
+			threads.push_back(std::thread(&WorkerPool::Run, this));
+		}
+	}
+}
+
+Xyz::WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	job_added.notify_all();
+
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+}
+
+void Xyz::WorkerPool::Submit(const std::function<void()>& job) {
+	if (threads.empty()) {
+		job();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(job);
+	}
+	job_added.notify_one();
+}
+
+void Xyz::WorkerPool::Wait() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!jobs.empty() || active > 0) {
+		job_done.wait(lock);
+	}
+}
+
+unsigned Xyz::WorkerPool::GetSize() const {
+	return size;
+}
+
+unsigned Xyz::WorkerPool::GetDefaultSize() {
+	unsigned count = std::thread::hardware_concurrency();
+	return count == 0 ? 1 : count;
+}
+
+unsigned Xyz::WorkerPool::GetMaxSize() {
+	unsigned size = GetDefaultSize() * 4;
+	return size < 16 ? 16 : size;
+}
+
+bool Xyz::WorkerPool::ParseSize(const std::string& str, unsigned& size) {
+	// Signed, so "-1" is not wrapped around to a huge count
+	char* end;
+	long value = strtol(str.c_str(), &end, 10);
+	if (str.empty() || *end != '\0' || value < 0 ||
+		static_cast<unsigned long>(value) > GetMaxSize()) {
+		return false;
+	}
+	size = static_cast<unsigned>(value);
+	return true;
+}
+
+void Xyz::WorkerPool::Run() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	for (;;) {
+		while (jobs.empty() && !stopping) {
+			job_added.wait(lock);
+		}
+		if (jobs.empty()) {
+			return;
+		}
+
+		std::function<void()> job = jobs.front();
+		jobs.pop_front();
+		active++;
+
+		lock.unlock();
+		job();
+		lock.lock();
+
+		active--;
+		job_done.notify_all();
+	}
+}
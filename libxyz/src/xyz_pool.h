@@ -0,0 +1,90 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBXYZ_XYZ_POOL_H
+#define LIBXYZ_XYZ_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Xyz {
+	/**
+	 * Fixed size pool of worker threads for batch conversions.
+	 *
+	 * With a single worker no thread is started and jobs run directly
+	 * inside Submit, which keeps sequential runs free of any overhead.
+	 */
+	class WorkerPool {
+	public:
+		/**
+		 * Starts the worker threads.
+		 *
+		 * @param count number of workers, 0 uses one per CPU
+		 */
+		explicit WorkerPool(unsigned count);
+
+		/** Finishes all queued jobs and stops the workers. */
+		~WorkerPool();
+
+		/** Queues a job for execution by the next free worker. */
+		void Submit(const std::function<void()>& job);
+
+		/** Blocks until all queued jobs have finished. */
+		void Wait();
+
+		/** Returns the number of workers. */
+		unsigned GetSize() const;
+
+		/** Returns the number of CPUs, at least 1. */
+		static unsigned GetDefaultSize();
+
+		/** Returns the largest accepted worker count, 4 per CPU or 16. */
+		static unsigned GetMaxSize();
+
+		/**
+		 * Parses a worker count given on the command line.
+		 *
+		 * @param str decimal number, 0 stands for one per CPU
+		 * @param size receives the count
+		 * @return false for anything else, negative numbers and counts
+		 *         above GetMaxSize
+		 */
+		static bool ParseSize(const std::string& str, unsigned& size);
+
+	private:
+		WorkerPool(const WorkerPool&);
+		WorkerPool& operator=(const WorkerPool&);
+
+		void Run();
+
+		unsigned size;
+		std::vector<std::thread> threads;
+		std::deque<std::function<void()> > jobs;
+		std::mutex mutex;
+		std::condition_variable job_added;
+		std::condition_variable job_done;
+		unsigned active;
+		bool stopping;
+	};
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_ZLIBNG
+
+#include "xyz_backend.h"
+#include <zlib-ng.h>
+
+Xyz::Result Xyz::InflateZlibNg(const unsigned char* in, size_t in_size,
+	unsigned char* out, size_t out_size) {
+	size_t written = out_size;
+	int32_t status = zng_uncompress(out, &written, in, in_size);
+
+	if (status == Z_MEM_ERROR) {
+		return ErrorMemory;
+	}
+	return status == Z_OK && written == out_size ? Ok : ErrorData;
+}
+
+Xyz::Result Xyz::DeflateZlibNg(const unsigned char* in, size_t in_size,
+	unsigned char* out, size_t& out_size, int level) {
+	int32_t status = zng_compress2(out, &out_size, in, in_size, level);
+
+	switch (status) {
+		case Z_OK:
+			return Ok;
+		case Z_MEM_ERROR:
+			return ErrorMemory;
+		case Z_BUF_ERROR:
+			return ErrorBufferSize;
+	}
+	return ErrorData;
+}
+
+size_t Xyz::GetDeflateBoundZlibNg(size_t in_size) {
+	return zng_compressBound(in_size);
+}
+
+#endif
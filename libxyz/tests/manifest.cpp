@@ -0,0 +1,136 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Records conversions in a manifest, saves and loads it again and checks
+ * which outputs are up to date after inputs, outputs and settings change.
+ */
+
+#include "xyz_manifest.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utime.h>
+
+namespace {
+	int failures = 0;
+
+	void Check(bool condition, const std::string& what) {
+		if (!condition) {
+			std::cerr << "FAIL: " << what << std::endl;
+			failures++;
+		}
+	}
+
+	void WriteText(const std::string& filename, const std::string& text) {
+		std::ofstream out(filename.c_str(), std::ios::binary);
+		out << text;
+	}
+
+	/** Sets the modification time of a file to the given second. */
+	void SetTime(const std::string& filename, long seconds) {
+		struct utimbuf times;
+		times.actime = seconds;
+		times.modtime = seconds;
+		utime(filename.c_str(), &times);
+	}
+
+	/** Records input as converted to output from its current contents. */
+	bool Record(Xyz::Manifest& manifest, const std::string& input,
+		const std::string& output, const std::string& settings,
+		const std::string& contents) {
+		const unsigned char* data =
+			reinterpret_cast<const unsigned char*>(contents.data());
+		return manifest.Update(input, output, settings,
+			Xyz::Hash(data, contents.size()), contents.size());
+	}
+}
+
+int main() {
+	// Names with every escaped character must survive Save and Load
+	const std::string input = "manifest in\t1\n\\.png";
+	const std::string output = "manifest out\t1\n\\.xyz";
+	const std::string settings = "level=9\tfilter\\none";
+	const std::string manifest_file = "manifest_test.txt";
+	WriteText(input, "input contents");
+	WriteText(output, "output contents");
+
+	Xyz::Manifest missing;
+	remove(manifest_file.c_str());
+	Check(missing.Load(manifest_file), "missing manifest loads empty");
+	Check(!missing.IsUpToDate(input, output, settings),
+		"empty manifest has nothing up to date");
+
+	Xyz::Manifest manifest;
+	Check(Record(manifest, input, output, settings, "input contents"),
+		"update after conversion");
+	Check(manifest.IsUpToDate(input, output, settings),
+		"up to date after update");
+	Check(!manifest.IsUpToDate(input, output, "level=1"),
+		"other settings are not up to date");
+	Check(!manifest.IsUpToDate(input, "other.xyz", settings),
+		"other output is not up to date");
+	Check(manifest.Save(manifest_file), "save manifest");
+
+	Xyz::Manifest loaded;
+	Check(loaded.Load(manifest_file), "load saved manifest");
+	Check(loaded.IsUpToDate(input, output, settings),
+		"escaped names survive save and load");
+
+	// A fresh checkout touches every file, but keeps the contents
+	SetTime(input, 1000000000);
+	SetTime(output, 1000000000);
+	Check(loaded.IsUpToDate(input, output, settings),
+		"touched files with the same contents are up to date");
+
+	// Same size, other contents and time
+	WriteText(input, "input_contents");
+	SetTime(input, 1100000000);
+	Check(!loaded.IsUpToDate(input, output, settings),
+		"changed input is not up to date");
+
+	WriteText(input, "input contents");
+	WriteText(output, "output_contents");
+	SetTime(output, 1100000000);
+	Check(!loaded.IsUpToDate(input, output, settings),
+		"changed output is not up to date");
+
+	// The input changed while it was converted
+	WriteText(input, "newer input contents");
+	Check(!Record(loaded, input, output, settings, "input contents"),
+		"update rejects an input changed during conversion");
+	Check(!loaded.IsUpToDate(input, output, settings),
+		"rejected update is not up to date");
+
+	WriteText(manifest_file, "XYZMANIFEST 0\n");
+	Check(!loaded.Load(manifest_file), "unknown signature fails to load");
+	WriteText(manifest_file, "XYZMANIFEST 1\na\tb\tc\t1\t2\n");
+	Check(!loaded.Load(manifest_file), "short line fails to load");
+	WriteText(manifest_file, "XYZMANIFEST 1\na\\q\tb\tc\t1\t2\t3\t4\t5\t6\n");
+	Check(!loaded.Load(manifest_file), "unknown escape fails to load");
+
+	remove(input.c_str());
+	remove(output.c_str());
+	remove(manifest_file.c_str());
+
+	if (failures != 0) {
+		std::cerr << failures << " checks failed." << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Optimizes palettes with duplicate, unused and equally frequent colors
+ * and checks that every pixel keeps its color, index 0 stays the
+ * transparent color and equal images give equal results.
+ */
+
+#include "xyz.h"
+#include "xyz_palette.h"
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+	int failures = 0;
+
+	void Check(bool condition, const std::string& what) {
+		if (!condition) {
+			std::cerr << "FAIL: " << what << std::endl;
+			failures++;
+		}
+	}
+
+	struct Image {
+		std::vector<unsigned char> palette;
+		std::vector<unsigned char> pixels;
+	};
+
+	Image MakeImage() {
+		Image image;
+		image.palette.assign(Xyz::PaletteSize, 0);
+		return image;
+	}
+
+	void SetColor(Image& image, int index, int r, int g, int b) {
+		image.palette[index * 3] = r;
+		image.palette[index * 3 + 1] = g;
+		image.palette[index * 3 + 2] = b;
+	}
+
+	/** Appends count pixels of a palette index. */
+	void AddPixels(Image& image, int index, size_t count) {
+		image.pixels.insert(image.pixels.end(), count,
+			static_cast<unsigned char>(index));
+	}
+
+	/** Returns the color of every pixel, three bytes each. */
+	std::vector<unsigned char> GetColors(const Image& image) {
+		std::vector<unsigned char> colors;
+		for (size_t i = 0; i < image.pixels.size(); i++) {
+			const unsigned char* color = &image.palette[image.pixels[i] * 3];
+			colors.insert(colors.end(), color, color + 3);
+		}
+		return colors;
+	}
+
+	bool HasColor(const Image& image, int index, int r, int g, int b) {
+		const unsigned char* color = &image.palette[index * 3];
+		return color[0] == r && color[1] == g && color[2] == b;
+	}
+
+	/**
+	 * Optimizes an image and checks that the colors of all pixels stay,
+	 * that exactly the pixels at index 0 before are at index 0 after and
+	 * that the entries behind the used ones are black.
+	 */
+	size_t Optimize(Image& image, const std::string& what) {
+		std::vector<unsigned char> colors = GetColors(image);
+		std::vector<unsigned char> before = image.pixels;
+		unsigned char key[3];
+		memcpy(key, image.palette.data(), 3);
+
+		size_t used = Xyz::OptimizePalette(image.palette.data(),
+			image.pixels.data(), image.pixels.size());
+
+		Check(GetColors(image) == colors, what + ": colors are kept");
+		Check(memcmp(image.palette.data(), key, 3) == 0,
+			what + ": index 0 keeps its color");
+		bool transparent_ok = true;
+		bool range_ok = true;
+		for (size_t i = 0; i < before.size(); i++) {
+			transparent_ok = transparent_ok
+				&& (before[i] == 0) == (image.pixels[i] == 0);
+			range_ok = range_ok && image.pixels[i] < used;
+		}
+		Check(transparent_ok, what + ": index 0 holds the same pixels");
+		Check(range_ok, what + ": pixels use the first entries");
+		bool black = true;
+		for (size_t i = used * 3; i < Xyz::PaletteSize; i++) {
+			black = black && image.palette[i] == 0;
+		}
+		Check(black, what + ": unused entries are black");
+		return used;
+	}
+}
+
+int main() {
+	// Duplicates are merged, the most frequent color comes first
+	Image duplicates = MakeImage();
+	SetColor(duplicates, 0, 255, 0, 255);
+	SetColor(duplicates, 3, 10, 20, 30);
+	SetColor(duplicates, 7, 10, 20, 30);
+	SetColor(duplicates, 9, 200, 100, 0);
+	SetColor(duplicates, 12, 1, 2, 3);
+	AddPixels(duplicates, 0, 4);
+	AddPixels(duplicates, 3, 5);
+	AddPixels(duplicates, 9, 8);
+	AddPixels(duplicates, 7, 6);
+	size_t used = Optimize(duplicates, "duplicates");
+	Check(used == 3, "duplicates: merged into one entry, unused dropped");
+	Check(HasColor(duplicates, 1, 10, 20, 30)
+		&& HasColor(duplicates, 2, 200, 100, 0),
+		"duplicates: ordered by frequency after merging");
+
+	// Other entries with the transparent color are not merged into it
+	Image key = MakeImage();
+	SetColor(key, 0, 0, 0, 0);
+	SetColor(key, 5, 0, 0, 0);
+	SetColor(key, 6, 50, 50, 50);
+	AddPixels(key, 5, 3);
+	AddPixels(key, 0, 10);
+	AddPixels(key, 6, 2);
+	used = Optimize(key, "key color");
+	Check(used == 3, "key color: black stays a separate entry");
+	Check(key.pixels[0] == 1 && key.pixels[13] == 2,
+		"key color: opaque black moves to index 1");
+
+	// Index 0 keeps its place when no pixel uses it
+	Image unused_key = MakeImage();
+	SetColor(unused_key, 0, 9, 9, 9);
+	SetColor(unused_key, 200, 9, 9, 9);
+	AddPixels(unused_key, 200, 4);
+	used = Optimize(unused_key, "unused key");
+	Check(used == 2 && unused_key.pixels[0] == 1,
+		"unused key: entry 1 is used, index 0 stays empty");
+
+	// Equally frequent colors are ordered by RGB value
+	Image ties = MakeImage();
+	SetColor(ties, 1, 90, 0, 0);
+	SetColor(ties, 2, 20, 5, 0);
+	SetColor(ties, 3, 20, 4, 255);
+	SetColor(ties, 4, 100, 0, 0);
+	for (int i = 0; i < 3; i++) {
+		AddPixels(ties, 1, 2);
+		AddPixels(ties, 2, 2);
+		AddPixels(ties, 3, 2);
+	}
+	AddPixels(ties, 4, 1);
+	used = Optimize(ties, "ties");
+	Check(used == 5 && HasColor(ties, 1, 20, 4, 255)
+		&& HasColor(ties, 2, 20, 5, 0) && HasColor(ties, 3, 90, 0, 0)
+		&& HasColor(ties, 4, 100, 0, 0), "ties: ordered by RGB value");
+
+	// A shuffled palette with the same colors gives the same image
+	Image shuffled = MakeImage();
+	const int indices[] = { 4, 3, 1, 2 };
+	for (int i = 0; i < 4; i++) {
+		memcpy(&shuffled.palette[(i + 1) * 3], &ties.palette[indices[i] * 3],
+			3);
+	}
+	SetColor(shuffled, 17, 20, 5, 0);
+	std::vector<unsigned char> colors = GetColors(ties);
+	for (size_t i = 0; i < colors.size(); i += 3) {
+		int index = 0;
+		for (int j = 1; j < 5; j++) {
+			if (memcmp(&shuffled.palette[j * 3], &colors[i], 3) == 0) {
+				index = j;
+			}
+		}
+		// Spread one color over two duplicate entries
+		if (index == 4 && i % 2 == 0) {
+			index = 17;
+		}
+		AddPixels(shuffled, index, 1);
+	}
+	Optimize(shuffled, "shuffled");
+	Check(shuffled.palette == ties.palette && shuffled.pixels == ties.pixels,
+		"shuffled: same palette and pixels as the original");
+
+	// Optimizing twice changes nothing
+	Image again = ties;
+	Optimize(again, "again");
+	Check(again.palette == ties.palette && again.pixels == ties.pixels,
+		"again: optimized images stay the same");
+
+	if (failures != 0) {
+		std::cerr << failures << " checks failed." << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * This file is part of libxyz. Copyright (c) 2018 libxyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Encodes tiny, flat and incompressible images with every encoder into a
+ * buffer of exactly GetEncodeBound bytes and decodes them again.
+ */
+
+#include "xyz.h"
+#include "xyz_pool.h"
+#include <zlib.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+	int failures = 0;
+
+	void Check(bool condition, const std::string& what) {
+		if (!condition) {
+			std::cerr << "FAIL: " << what << std::endl;
+			failures++;
+		}
+	}
+
+	/** Fills a buffer with reproducible noise, which deflate cannot shrink. */
+	void FillNoise(std::vector<unsigned char>& data, unsigned seed) {
+		for (size_t i = 0; i < data.size(); i++) {
+			seed = seed * 1103515245 + 12345;
+			data[i] = (seed >> 16) & 0xFF;
+		}
+	}
+
+	struct Image {
+		std::string name;
+		Xyz::Header header;
+		std::vector<unsigned char> palette;
+		std::vector<unsigned char> pixels;
+	};
+
+	Image MakeImage(const std::string& name, unsigned short width,
+		unsigned short height, bool noise) {
+		Image image;
+		image.name = name;
+		image.header.width = width;
+		image.header.height = height;
+		image.palette.resize(Xyz::PaletteSize);
+		image.pixels.resize(Xyz::GetPixelsSize(image.header));
+		FillNoise(image.palette, width * 31 + height);
+		if (noise) {
+			FillNoise(image.pixels, width + height * 31);
+		}
+		return image;
+	}
+
+	/** Checks that a XYZ file is valid and holds the given image. */
+	void CheckDecode(const std::vector<unsigned char>& file,
+		const Image& image, const unsigned char* palette,
+		const std::string& what) {
+		Xyz::VerifyInfo info;
+		Xyz::Result result = Xyz::Verify(&file.front(), file.size(), info);
+		Check(result == Xyz::Ok, what + ": verify " +
+			Xyz::GetResultString(result));
+
+		Xyz::Header header;
+		std::vector<unsigned char> decoded_palette(Xyz::PaletteSize);
+		std::vector<unsigned char> decoded_pixels(image.pixels.size());
+		result = Xyz::Decode(&file.front(), file.size(), header,
+			&decoded_palette.front(), &decoded_pixels.front(),
+			decoded_pixels.size());
+		Check(result == Xyz::Ok, what + ": decode " +
+			Xyz::GetResultString(result));
+		Check(header.width == image.header.width &&
+			header.height == image.header.height, what + ": header");
+		Check(memcmp(&decoded_palette.front(), palette,
+			Xyz::PaletteSize) == 0, what + ": palette");
+		Check(decoded_pixels == image.pixels, what + ": pixels");
+	}
+
+	void TestImage(const Image& image, Xyz::WorkerPool& pool) {
+		size_t bound = Xyz::GetEncodeBound(image.header);
+		std::vector<unsigned char> file(bound);
+		size_t size = bound;
+		Xyz::Result result = Xyz::Encode(image.header, &image.palette.front(),
+			&image.pixels.front(), &file.front(), size);
+		Check(result == Xyz::Ok, image.name + ": Encode " +
+			Xyz::GetResultString(result));
+		file.resize(size);
+		CheckDecode(file, image, &image.palette.front(),
+			image.name + ": Encode");
+
+		file.assign(bound, 0);
+		size = bound;
+		result = Xyz::EncodeParallel(image.header, &image.palette.front(),
+			&image.pixels.front(), &file.front(), size, pool);
+		Check(result == Xyz::Ok, image.name + ": EncodeParallel " +
+			Xyz::GetResultString(result));
+		file.resize(size);
+		CheckDecode(file, image, &image.palette.front(),
+			image.name + ": EncodeParallel");
+
+		file.assign(bound, 0);
+		size = bound;
+		result = Xyz::EncodeSplit(image.header, &image.palette.front(),
+			&image.pixels.front(), &file.front(), size);
+		Check(result == Xyz::Ok, image.name + ": EncodeSplit " +
+			Xyz::GetResultString(result));
+		file.resize(size);
+		CheckDecode(file, image, &image.palette.front(),
+			image.name + ": EncodeSplit");
+
+		// A patched file can be patched again
+		std::vector<unsigned char> palette(Xyz::PaletteSize);
+		std::vector<unsigned char> patched;
+		for (unsigned i = 0; i < 2; i++) {
+			FillNoise(palette, i + 1);
+			result = Xyz::PatchPalette(&file.front(), file.size(),
+				&palette.front(), patched);
+			Check(result == Xyz::Ok, image.name + ": PatchPalette " +
+				Xyz::GetResultString(result));
+			CheckDecode(patched, image, &palette.front(),
+				image.name + ": PatchPalette");
+			file.swap(patched);
+		}
+	}
+
+	/** The pixels behind a sync flush may refer back into the palette. */
+	void TestSyncFlush() {
+		Image image = MakeImage("sync", 64, 4, false);
+		memcpy(&image.pixels.front(), &image.palette.front(),
+			image.pixels.size());
+
+		std::vector<unsigned char> file(Xyz::GetEncodeBound(image.header));
+		memcpy(&file.front(), "XYZ1\x40\x00\x04\x00", Xyz::HeaderSize);
+
+		z_stream strm;
+		memset(&strm, 0, sizeof(strm));
+		deflateInit(&strm, 9);
+		strm.next_out = &file.front() + Xyz::HeaderSize;
+		strm.avail_out = static_cast<uInt>(file.size() - Xyz::HeaderSize);
+		strm.next_in = &image.palette.front();
+		strm.avail_in = static_cast<uInt>(image.palette.size());
+		deflate(&strm, Z_SYNC_FLUSH);
+		strm.next_in = &image.pixels.front();
+		strm.avail_in = static_cast<uInt>(image.pixels.size());
+		int status = deflate(&strm, Z_FINISH);
+		file.resize(Xyz::HeaderSize + strm.total_out);
+		deflateEnd(&strm);
+		Check(status == Z_STREAM_END, "sync: deflate");
+		CheckDecode(file, image, &image.palette.front(), "sync");
+
+		std::vector<unsigned char> palette(Xyz::PaletteSize);
+		std::vector<unsigned char> patched;
+		Xyz::Result result = Xyz::PatchPalette(&file.front(), file.size(),
+			&palette.front(), patched);
+		Check(result == Xyz::ErrorNotSplit, std::string("sync: PatchPalette ") +
+			Xyz::GetResultString(result));
+	}
+}
+
+int main() {
+	Xyz::WorkerPool pool(4);
+
+	TestImage(MakeImage("1x1 flat", 1, 1, false), pool);
+	TestImage(MakeImage("1x1 noise", 1, 1, true), pool);
+	TestImage(MakeImage("320x240 flat", 320, 240, false), pool);
+	TestImage(MakeImage("320x240 noise", 320, 240, true), pool);
+	TestImage(MakeImage("640x480 noise", 640, 480, true), pool);
+	TestSyncFlush();
+
+	return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * This file is part of png2xyz. Copyright (c) 2015 png2xyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bmp_reader.h"
+#include <cstring>
+
+namespace {
+	/** Size of BITMAPFILEHEADER. */
+	const size_t FileHeaderSize = 14;
+
+	/** Size of the OS/2 BITMAPCOREHEADER, which has 16 bit dimensions. */
+	const size_t CoreHeaderSize = 12;
+
+	/** Size of BITMAPINFOHEADER, later versions only append fields. */
+	const size_t InfoHeaderSize = 40;
+
+	const unsigned CompressionNone = 0;
+	const unsigned CompressionRle8 = 1;
+
+	unsigned ReadLittleEndian(const unsigned char* data, int bytes) {
+		unsigned value = 0;
+		for(int i = bytes - 1; i >= 0; i--) {
+			value = (value << 8) | data[i];
+		}
+		return value;
+	}
+}
+
+BmpReader::BmpReader() : data(NULL), size(0), error(""), width(0),
+	height(0), top_down(false), compressed(false), pixels_offset(0),
+	stride(0), palette(NULL), palette_entries(0), palette_entry_size(0) {
+}
+
+bool BmpReader::Open(const unsigned char* data, size_t size) {
+	this->data = data;
+	this->size = size;
+
+	if(size < FileHeaderSize + CoreHeaderSize
+		|| data[0] != 'B' || data[1] != 'M') {
+		error = "is not a BMP file";
+		return false;
+	}
+
+	pixels_offset = ReadLittleEndian(&data[10], 4);
+	size_t header_size = ReadLittleEndian(&data[14], 4);
+	const unsigned char* info = &data[FileHeaderSize];
+	long bmp_width;
+	long bmp_height;
+	unsigned bit_count;
+	unsigned compression = CompressionNone;
+	size_t colors_used = 0;
+
+	if(header_size == CoreHeaderSize) {
+		bmp_width = ReadLittleEndian(&info[4], 2);
+		bmp_height = ReadLittleEndian(&info[6], 2);
+		bit_count = ReadLittleEndian(&info[10], 2);
+		palette_entry_size = 3;
+	} else if(header_size >= InfoHeaderSize
+		&& size >= FileHeaderSize + header_size) {
+		// Signed 32 bit, a negative height means top down rows
+		bmp_width = (int) ReadLittleEndian(&info[4], 4);
+		bmp_height = (int) ReadLittleEndian(&info[8], 4);
+		bit_count = ReadLittleEndian(&info[14], 2);
+		compression = ReadLittleEndian(&info[16], 4);
+		colors_used = ReadLittleEndian(&info[32], 4);
+		palette_entry_size = 4;
+	} else {
+		error = "has an unsupported header";
+		return false;
+	}
+
+	if(bit_count != 8) {
+		error = "is not using 8 bit palette indices";
+		return false;
+	}
+	if(compression != CompressionNone && compression != CompressionRle8) {
+		error = "uses an unsupported compression";
+		return false;
+	}
+	compressed = compression == CompressionRle8;
+
+	top_down = bmp_height < 0;
+	if(top_down) {
+		bmp_height = -bmp_height;
+	}
+	if(bmp_width <= 0 || bmp_height <= 0) {
+		error = "has invalid dimensions";
+		return false;
+	}
+	if(bmp_width > 0xFFFF || bmp_height > 0xFFFF) {
+		error = "is too large for a XYZ file";
+		return false;
+	}
+	if(top_down && compressed) {
+		error = "is compressed but stored top down";
+		return false;
+	}
+	width = bmp_width;
+	height = bmp_height;
+
+	// Palette behind the headers, all 256 entries unless stated otherwise
+	palette_entries = colors_used == 0 || colors_used > 256 ? 256 :
+		colors_used;
+	palette = &data[FileHeaderSize + header_size];
+	size_t palette_end = FileHeaderSize + header_size
+		+ palette_entries * palette_entry_size;
+	if(palette_end > size) {
+		// Some writers store fewer entries than announced
+		palette_entries = (size - FileHeaderSize - header_size)
+			/ palette_entry_size;
+	}
+
+	stride = ((size_t) width + 3) & ~(size_t) 3;
+	if(pixels_offset > size || (!compressed
+		&& (size - pixels_offset) / stride < height)) {
+		error = "is truncated";
+		return false;
+	}
+
+	return true;
+}
+
+const char* BmpReader::GetError() const {
+	return error;
+}
+
+unsigned short BmpReader::GetWidth() const {
+	return width;
+}
+
+unsigned short BmpReader::GetHeight() const {
+	return height;
+}
+
+void BmpReader::GetPalette(unsigned char* palette) const {
+	memset(palette, 0, 768);
+	for(size_t i = 0; i < palette_entries; i++) {
+		const unsigned char* entry = &this->palette[i * palette_entry_size];
+		palette[i * 3] = entry[2];
+		palette[i * 3 + 1] = entry[1];
+		palette[i * 3 + 2] = entry[0];
+	}
+}
+
+bool BmpReader::IsCompressed() const {
+	return compressed;
+}
+
+const unsigned char* BmpReader::GetRow(size_t y) const {
+	size_t row = top_down ? y : height - 1 - y;
+	return &data[pixels_offset + row * stride];
+}
+
+bool BmpReader::Decompress(unsigned char* pixels) {
+	const unsigned char* in = &data[pixels_offset];
+	const unsigned char* end = &data[size];
+	size_t x = 0;
+	size_t row = 0;
+
+	memset(pixels, 0, (size_t) width * height);
+	error = "has corrupt RLE8 data";
+
+	// Rows are stored bottom up, row counts from the bottom
+	while(end - in >= 2 && row < height) {
+		unsigned count = in[0];
+		unsigned value = in[1];
+		in += 2;
+		unsigned char* out = &pixels[(height - 1 - row) * (size_t) width];
+
+		if(count > 0) {
+			// Encoded run
+			if(x + count > width) {
+				return false;
+			}
+			memset(&out[x], value, count);
+			x += count;
+		} else if(value == 0) {
+			// End of line
+			x = 0;
+			row++;
+		} else if(value == 1) {
+			// End of bitmap
+			return true;
+		} else if(value == 2) {
+			// Delta, the skipped pixels keep index 0
+			if(end - in < 2) {
+				return false;
+			}
+			x += in[0];
+			row += in[1];
+			in += 2;
+			if(x > width) {
+				return false;
+			}
+		} else {
+			// Absolute run, padded to an even number of bytes
+			size_t padded = (value + 1) & ~1u;
+			if(x + value > width || (size_t) (end - in) < padded) {
+				return false;
+			}
+			memcpy(&out[x], in, value);
+			x += value;
+			in += padded;
+		}
+	}
+
+	// Some writers omit the end of bitmap marker after the last row
+	return row >= height;
+}
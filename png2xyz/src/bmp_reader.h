@@ -0,0 +1,86 @@
+/*
+ * This file is part of png2xyz. Copyright (c) 2015 png2xyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PNG2XYZ_BMP_READER_H
+#define PNG2XYZ_BMP_READER_H
+
+#include <cstddef>
+
+/**
+ * Reader for 8 bit palette BMP files held in memory.
+ *
+ * Uncompressed rows are returned as pointers into the file data, stored
+ * bottom up or top down, so a mapped file is converted without copying
+ * the image. RLE8 compressed images are decompressed into a caller
+ * buffer. Pixels skipped by RLE8 deltas get palette index 0.
+ */
+class BmpReader {
+public:
+	BmpReader();
+
+	/**
+	 * Parses the headers of a BMP file.
+	 *
+	 * @param data start of the BMP file, must stay valid while reading
+	 * @param size number of bytes available at data
+	 * @return whether the file is a supported BMP, see GetError
+	 */
+	bool Open(const unsigned char* data, size_t size);
+
+	/** Returns why Open or Decompress failed. */
+	const char* GetError() const;
+
+	unsigned short GetWidth() const;
+	unsigned short GetHeight() const;
+
+	/**
+	 * Copies the palette as 256 RGB entries, entries missing in the file
+	 * are black.
+	 */
+	void GetPalette(unsigned char* palette) const;
+
+	/** Returns whether the image is RLE8 compressed. */
+	bool IsCompressed() const;
+
+	/** Returns row y, counted from the top, of an uncompressed image. */
+	const unsigned char* GetRow(size_t y) const;
+
+	/**
+	 * Decompresses a RLE8 image.
+	 *
+	 * @param pixels receives width * height palette indices, rows top to
+	 *               bottom
+	 * @return false when the compressed data is corrupt
+	 */
+	bool Decompress(unsigned char* pixels);
+
+private:
+	const unsigned char* data;
+	size_t size;
+	const char* error;
+	unsigned short width;
+	unsigned short height;
+	bool top_down;
+	bool compressed;
+	size_t pixels_offset;
+	size_t stride;
+	const unsigned char* palette;
+	size_t palette_entries;
+	size_t palette_entry_size;
+};
+
+#endif
@@ -17,11 +17,25 @@
 
 #include <zlib.h>
 #include <png.h>
+#include <xyz.h>
+#include <xyz_dir.h>
+#include <xyz_file.h>
+#include <xyz_manifest.h>
+#include <xyz_palette.h>
+#include <xyz_pool.h>
+#include "bmp_reader.h"
+#include "quantizer.h"
+#include <cctype>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <vector>
 #ifdef _WIN32
 # include <algorithm>
 #endif
@@ -36,6 +50,122 @@ std::string GetFilename(const std::string& str);
 /** Returns that path (everything left to the last /) */
 std::string GetPath(const std::string& str);
 
+/** Conversion settings from the command line. */
+struct Options {
+	/** Number of files converted in parallel. */
+	unsigned jobs;
+	/** Deflates the blocks of all images, NULL disables blocks. */
+	Xyz::WorkerPool* block_pool;
+	/** Encode row by row instead of the whole image at once. */
+	bool stream;
+	/** Skips files converted before, NULL to convert all files. */
+	Xyz::Manifest* manifest;
+	/** Manifest settings, changes when options influence the output. */
+	std::string manifest_settings;
+	/** Dither truecolor images when reducing their colors. */
+	bool dither;
+	/** Whether key_color is mapped to index 0 in truecolor images. */
+	bool has_key;
+	unsigned char key_color[3];
+	/** Inflate every compressed file again and compare it to the image. */
+	bool verify;
+	/** Merge, sort and clear palette entries before compressing. */
+	bool optimize_palette;
+	/** End the palette in a flush point, see Xyz::EncodeSplit. */
+	bool split_palette;
+};
+
+/** Outcome of the round trip check of a single file. */
+struct VerifyReport {
+	/** Whether the file was checked, conversion can fail before. */
+	bool checked;
+	/** "ok", "mismatch" or the name of the inflate error. */
+	const char* result;
+	Xyz::Header header;
+	/** Size of the checked XYZ file. */
+	size_t xyz_size;
+};
+
+/**
+ * State a worker thread keeps across files. The buffers only grow, so a
+ * batch run stops allocating per file after the largest image.
+ */
+struct WorkerContext {
+	/** Input file, closed after every file but keeps its read buffer. */
+	Xyz::InputFile input;
+	/** Incremental encoder, its zlib state is reset for every file. */
+	Xyz::Encoder encoder;
+	/** Palette directly followed by the pixels, or by one row. */
+	std::vector<unsigned char> image;
+	/** Row pointers into image or rgba for libpng. */
+	std::vector<png_bytep> row_pointers;
+	/** Truecolor image before quantization. */
+	std::vector<unsigned char> rgba;
+	/** Reduces truecolor images to the XYZ palette. */
+	Quantizer quantizer;
+	/** Encoded XYZ file. */
+	std::vector<unsigned char> xyz_data;
+	/** XYZ file inflated again by the round trip check. */
+	std::vector<unsigned char> decoded;
+	/** Round trip check of the last file. */
+	VerifyReport verify;
+};
+
+/**
+ * Converts a PNG or BMP file into a XYZ file, errors are written to err.
+ * Files are recognized by their extension, standard input by its first
+ * byte.
+ */
+bool ConvertFile(const std::string& filename,
+	const std::string& xyz_filename, const Options& options,
+	WorkerContext& context, std::ostream& err);
+
+/**
+ * Converts an 8 bit BMP file into a XYZ file. Uncompressed rows are
+ * deflated straight from the mapped file. Errors are written to err.
+ */
+bool ConvertBmpFile(const std::string& filename,
+	const Xyz::InputFile& bmp_file, const std::string& xyz_filename,
+	const Options& options, WorkerContext& context, std::ostream& err);
+
+/**
+ * Compresses the palette and the pixels in context.image and writes the
+ * XYZ file, errors are written to err.
+ */
+bool WriteXyzFile(const Xyz::Header& header, const std::string& filename,
+	const std::string& xyz_filename, const Options& options,
+	WorkerContext& context, std::ostream& err);
+
+/**
+ * Inflates the XYZ file in context.xyz_data again and compares palette and
+ * pixels to context.image. The outcome is stored in context.verify.
+ */
+bool VerifyXyzData(const Xyz::Header& header, size_t xyz_size,
+	WorkerContext& context);
+
+/** Returns whether a filename ends with extension, ignoring case. */
+bool HasExtension(const std::string& filename, const std::string& extension);
+
+/** PNG file in memory read by libpng, see ReadPngData. */
+struct PngInput {
+	const unsigned char* data;
+	size_t size;
+	size_t offset;
+};
+
+/** libpng read callback, reads from the PngInput of png_ptr. */
+void ReadPngData(png_structp png_ptr, png_bytep data, png_size_t length);
+
+/** Returns the output path of a file in an output directory. */
+std::string GetOutputFilename(const std::string& output_dir,
+	const std::string& name);
+
+/** Opens an input file, "-" reads standard input. */
+bool OpenInputFile(Xyz::InputFile& file, const std::string& filename);
+
+/** Parses a RGB color written as rrggbb or #rrggbb. */
+bool ParseColor(const std::string& str, unsigned char* color);
+
 std::string GetFilename(const std::string& str) {
 	std::string s = str;
 #ifdef _WIN32
@@ -76,190 +206,805 @@ std::string GetPath(const std::string& str) {
 	return s;
 }
 
-int main(int argc, char* argv[]) {
-	if(argc < 2)
-	{
-		std::cout << "Usage: " << argv[0]
-			<< " filename" << std::endl;
-		return 1;
+std::string GetOutputFilename(const std::string& output_dir,
+	const std::string& name) {
+	if(output_dir.empty()) {
+		return name;
 	}
+	return output_dir + "/" + name;
+}
 
-	for(int arg = 1; arg < argc; arg++) {
-		FILE *png_file;
-		unsigned char* header;
-		png_structp png_ptr;
-		png_infop info_ptr;
-		unsigned short width;
-		unsigned short height;
-		unsigned int bit_depth;
-		unsigned int color_type;
-		png_colorp palette;
-		int num_palette;
-		png_bytep *row_pointers;
-		Bytef* xyz_data;
-		uLong comp_size;
-		Bytef* comp_data;
-		std::string xyz_filename;
-
-		// Open PNG file
-		png_file = fopen(argv[arg], "rb");
-		if(png_file == NULL) {
-			std::cerr << "Error reading file "
-				<< argv[arg] << "." << std::endl;
-			return 1;
-		}
+bool OpenInputFile(Xyz::InputFile& file, const std::string& filename) {
+	if(filename == "-") {
+		return file.OpenStdin();
+	}
+	return file.Open(filename);
+}
 
-		// Read PNG file header
-		header = new unsigned char[8];
-		if (fread(header, 1, 8, png_file) != 8) {
-			std::cerr << "Error reading PNG header of file "
-				<< argv[arg] << "." << std::endl;
-			delete[] header;
-			return 1;
-		}
+void ReadPngData(png_structp png_ptr, png_bytep data, png_size_t length) {
+	PngInput* input = static_cast<PngInput*>(png_get_io_ptr(png_ptr));
+	if(length > input->size - input->offset) {
+		png_error(png_ptr, "Unexpected end of file");
+	}
+	memcpy(data, input->data + input->offset, length);
+	input->offset += length;
+}
 
-		// Check PNG validity
-		if(png_sig_cmp(header, 0, 8) != 0) {
-			std::cerr << "Input file " << argv[arg]
-				<< " is not a PNG file." << std::endl;
-			delete[] header;
-			return 1;
-		}
-		delete[] header;
-
-		// Create PNG read structure
-		png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL,
-			NULL, NULL);
-		if(png_ptr == NULL)
-		{
-			std::cerr << "Error creating PNG read structure for "
-				<< argv[arg] << "." << std::endl;
-			fclose(png_file);
-			return 1;
-		}
+bool VerifyXyzData(const Xyz::Header& header, size_t xyz_size,
+	WorkerContext& context) {
+	VerifyReport& verify = context.verify;
+	verify.checked = true;
+	verify.header = header;
+	verify.xyz_size = xyz_size;
+
+	size_t size = Xyz::PaletteSize + Xyz::GetPixelsSize(header);
+	std::vector<unsigned char>& decoded = context.decoded;
+	decoded.resize(size);
+
+	Xyz::Header decoded_header;
+	Xyz::Result result = Xyz::Decode(context.xyz_data.data(), xyz_size,
+		decoded_header, decoded.data(), decoded.data() + Xyz::PaletteSize,
+		size - Xyz::PaletteSize);
+	if(result != Xyz::Ok) {
+		verify.result = Xyz::GetResultName(result);
+		return false;
+	}
 
-		// Create PNG info structure
-		info_ptr = png_create_info_struct(png_ptr);
-		if(info_ptr == NULL)
-		{
-			std::cerr << "Error creating PNG info structure for "
-				<< argv[arg] << "." << std::endl;
-			png_destroy_read_struct(&png_ptr, NULL, NULL);
-			fclose(png_file);
-			return 1;
-		}
+	if(decoded_header.width != header.width
+		|| decoded_header.height != header.height
+		|| memcmp(decoded.data(), context.image.data(), size) != 0) {
+		verify.result = "mismatch";
+		return false;
+	}
 
-		// Init I/O functions
-		if(setjmp(png_jmpbuf(png_ptr)))
-		{
-			std::cerr << "Error initializing PNG I/O for "
-				<< argv[arg] << "." << std::endl;
-			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-			fclose(png_file);
-			return 1;
+	verify.result = "ok";
+	return true;
+}
+
+bool HasExtension(const std::string& filename, const std::string& extension) {
+	if(filename.size() < extension.size()) {
+		return false;
+	}
+
+	size_t offset = filename.size() - extension.size();
+	for(size_t i = 0; i < extension.size(); i++) {
+		if(tolower((unsigned char) filename[offset + i])
+			!= tolower((unsigned char) extension[i])) {
+			return false;
 		}
-		png_init_io(png_ptr, png_file);
+	}
+	return true;
+}
 
-		// Already read 8 header bytes, let libpng know about this
-		png_set_sig_bytes(png_ptr, 8);
+bool ParseColor(const std::string& str, unsigned char* color) {
+	std::string hex = str.compare(0, 1, "#") == 0 ? str.substr(1) : str;
+	if(hex.size() != 6
+		|| hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+		return false;
+	}
 
-		// Read PNG
-		png_read_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
+	for(int i = 0; i < 3; i++) {
+		color[i] = (unsigned char) strtoul(hex.substr(i * 2, 2).c_str(),
+			NULL, 16);
+	}
+	return true;
+}
 
-		// Check PNG dimensions
-		width = png_get_image_width(png_ptr, info_ptr);
-		height = png_get_image_height(png_ptr, info_ptr);
+bool ConvertFile(const std::string& filename,
+	const std::string& xyz_filename, const Options& options,
+	WorkerContext& context, std::ostream& err) {
+	png_structp png_ptr;
+	png_infop info_ptr;
+	unsigned short width;
+	unsigned short height;
+	unsigned int bit_depth;
+	unsigned int color_type;
+	png_colorp palette;
+	int num_palette;
+
+	bool from_stdin = filename == "-";
+	bool to_stdout = xyz_filename == "-";
+	Xyz::Manifest* manifest = from_stdin || to_stdout ? NULL :
+		options.manifest;
+	context.verify.checked = false;
+
+	if(manifest != NULL && manifest->IsUpToDate(filename,
+		xyz_filename, options.manifest_settings)) {
+		return true;
+	}
 
-		// Check bit depth validity
-		bit_depth = png_get_bit_depth(png_ptr, info_ptr);
-		if(bit_depth != 8) {
-			std::cerr << "PNG file " << argv[arg]
-				<< " is not using 8 bit depth." << std::endl;
-			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-			fclose(png_file);
-			return 1;
-		}
+	if(!to_stdout && !Xyz::CreateDirectories(GetPath(xyz_filename))) {
+		err << "Error creating directory "
+			<< GetPath(xyz_filename) << "." << std::endl;
+		return false;
+	}
 
-		// Check color type validity
-		color_type = png_get_color_type(png_ptr, info_ptr);
-		if(color_type != PNG_COLOR_TYPE_PALETTE) {
-			std::cerr << "PNG file " << argv[arg]
-				<< " is not palette based." << std::endl;
-			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-			fclose(png_file);
-			return 1;
+	// Open input file, "-" reads standard input
+	Xyz::InputFile& input_file = context.input;
+	if(!OpenInputFile(input_file, filename)) {
+		err << "Error reading file "
+			<< filename << "." << std::endl;
+		return false;
+	}
+
+	// The manifest records the contents that were converted
+	const unsigned char* data = input_file.GetData();
+	size_t size = input_file.GetSize();
+	unsigned long long hash = manifest != NULL ?
+		Xyz::Hash(data, size) : 0;
+
+	// BMP files start with "BM", PNG files with 0x89
+	bool bmp = from_stdin ? size > 0 && data[0] == 'B' :
+		HasExtension(filename, ".bmp");
+	if(bmp) {
+		bool success = ConvertBmpFile(filename, input_file, xyz_filename,
+			options, context, err);
+		if(success && manifest != NULL) {
+			manifest->Update(filename, xyz_filename,
+				options.manifest_settings, hash, size);
 		}
+		return success;
+	}
+
+	// Check PNG validity
+	if(size < 8) {
+		err << "Error reading PNG header of file "
+			<< filename << "." << std::endl;
+		return false;
+	}
+	if(png_sig_cmp(data, 0, 8) != 0) {
+		err << "Input file " << filename
+			<< " is not a PNG file." << std::endl;
+		return false;
+	}
+
+	// Create PNG read structure
+	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL,
+		NULL, NULL);
+	if(png_ptr == NULL)
+	{
+		err << "Error creating PNG read structure for "
+			<< filename << "." << std::endl;
+		return false;
+	}
+
+	// Create PNG info structure
+	info_ptr = png_create_info_struct(png_ptr);
+	if(info_ptr == NULL)
+	{
+		err << "Error creating PNG info structure for "
+			<< filename << "." << std::endl;
+		png_destroy_read_struct(&png_ptr, NULL, NULL);
+		return false;
+	}
 
+	// Init I/O functions
+	if(setjmp(png_jmpbuf(png_ptr)))
+	{
+		err << "Error initializing PNG I/O for "
+			<< filename << "." << std::endl;
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		return false;
+	}
+	PngInput png_input = { data, size, 8 };
+	png_set_read_fn(png_ptr, &png_input, ReadPngData);
+
+	// Already read 8 header bytes, let libpng know about this
+	png_set_sig_bytes(png_ptr, 8);
+
+	// Read PNG header
+	png_read_info(png_ptr, info_ptr);
+
+	// Check PNG dimensions
+	if(png_get_image_width(png_ptr, info_ptr) > 0xFFFF ||
+		png_get_image_height(png_ptr, info_ptr) > 0xFFFF) {
+		err << "PNG file " << filename
+			<< " is too large for a XYZ file." << std::endl;
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		return false;
+	}
+	width = png_get_image_width(png_ptr, info_ptr);
+	height = png_get_image_height(png_ptr, info_ptr);
+
+	bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+	color_type = png_get_color_type(png_ptr, info_ptr);
+	bool indexed = color_type == PNG_COLOR_TYPE_PALETTE;
+
+	if(indexed) {
 		// Check palette chunk validity
 		if(png_get_valid(png_ptr, info_ptr, PNG_INFO_PLTE) == 0) {
-			std::cerr << "PNG file " << argv[arg]
+			err << "PNG file " << filename
 				<< " has an invalid palette chunk."
 				<< std::endl;
 			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-			fclose(png_file);
-			return 1;
+			return false;
 		}
 
 		// Get palette and color count
 		png_get_PLTE(png_ptr, info_ptr, &palette, &num_palette);
 
-		// Check palette color count validity
-		if(num_palette != 256) {
-			std::cerr << "PNG file " << argv[arg]
-				<< " has lesser than 256 colors in palette."
-				<< std::endl;
-			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-			fclose(png_file);
-			return 1;
+		// One index per byte for 1, 2 and 4 bit images
+		if(bit_depth < 8) {
+			png_set_packing(png_ptr);
 		}
+	} else {
+		// Truecolor and grayscale images are read as 8 bit RGBA
+		png_set_expand(png_ptr);
+		png_set_strip_16(png_ptr);
+		png_set_gray_to_rgb(png_ptr);
+		png_set_filler(png_ptr, 0xFF, PNG_FILLER_AFTER);
+	}
 
-		xyz_data = new unsigned char[768 + width * height];
+	Xyz::Header xyz_header;
+	xyz_header.width = width;
+	xyz_header.height = height;
+
+	// Interlaced images need all passes before a row is complete,
+	// truecolor images need all pixels to choose a palette
+	bool stream = options.stream && indexed && !options.verify &&
+		!options.optimize_palette &&
+		png_get_interlace_type(png_ptr, info_ptr) == PNG_INTERLACE_NONE;
+
+	// Pixels directly behind the palette save a copy in most backends
+	size_t pixels_size = stream ? width : Xyz::GetPixelsSize(xyz_header);
+	context.image.resize(Xyz::PaletteSize + pixels_size);
+	unsigned char* xyz_pixels = context.image.data() + Xyz::PaletteSize;
+
+	// Create XYZ palette, smaller palettes are padded with black
+	if(indexed) {
+		memset(context.image.data(), 0, Xyz::PaletteSize);
+		for (int i = 0; i < num_palette && i < 256; i++) {
+			context.image[i * 3] = palette[i].red;
+			context.image[i * 3 + 1] = palette[i].green;
+			context.image[i * 3 + 2] = palette[i].blue;
+		}
+	}
 
-		// Create XYZ palette
-		for (size_t i = 0; i < 256; i++) {
-			xyz_data[i * 3] = palette[i].red;
-			xyz_data[i * 3 + 1] = palette[i].green;
-			xyz_data[i * 3 + 2] = palette[i].blue;
+	if(stream) {
+		// Deflate every row as soon as libpng has decoded it
+		std::ofstream xyz_file;
+		if(to_stdout) {
+			Xyz::SetBinaryMode(stdout);
+		} else {
+			xyz_file.open(xyz_filename.c_str(), std::ofstream::binary);
+		}
+		std::ostream& xyz_out = to_stdout ? std::cout : xyz_file;
+		Xyz::Encoder& encoder = context.encoder;
+
+		// volatile: modified between setjmp and a possible longjmp
+		volatile Xyz::Result result = encoder.Begin(xyz_header, xyz_out,
+			Z_BEST_COMPRESSION);
+		if(result == Xyz::Ok) {
+			result = encoder.WritePalette(context.image.data(),
+				options.split_palette);
 		}
 
-		// Get image rows
-		row_pointers = png_get_rows(png_ptr, info_ptr);
+		if(setjmp(png_jmpbuf(png_ptr))) {
+			err << "Error reading PNG image of file "
+				<< filename << "." << std::endl;
+			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+			if(!to_stdout) {
+				xyz_file.close();
+				remove(xyz_filename.c_str());
+			}
+			return false;
+		}
+		for(size_t y = 0; y < height && result == Xyz::Ok; y++) {
+			png_read_row(png_ptr, xyz_pixels, NULL);
+			result = encoder.WriteRow(xyz_pixels);
+		}
+		if(result == Xyz::Ok) {
+			result = encoder.Finish();
+		}
 
-		// Create XYZ image
-		for (size_t y = 0; y < height; y++) {
-			memcpy(&xyz_data[768 + y * width],
-			row_pointers[y], width);
+		// Release libpng
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+		if(to_stdout) {
+			xyz_out.flush();
+		} else {
+			xyz_file.close();
+		}
+		if(result != Xyz::Ok || !xyz_out) {
+			err << "Error while writing XYZ file "
+				<< xyz_filename << "." << std::endl;
+			if(!to_stdout) {
+				remove(xyz_filename.c_str());
+			}
+			return false;
 		}
 
-		// Close PNG file
+		if(manifest != NULL) {
+			manifest->Update(filename, xyz_filename,
+				options.manifest_settings, hash, size);
+		}
+		return true;
+	}
+
+	// Read the rows straight into the XYZ image, truecolor images into
+	// a separate buffer for quantization
+	std::vector<png_bytep>& row_pointers = context.row_pointers;
+	row_pointers.resize(height);
+	if(!indexed) {
+		context.rgba.resize(Xyz::GetPixelsSize(xyz_header) * 4);
+	}
+	for (size_t y = 0; y < height; y++) {
+		row_pointers[y] = indexed ? &xyz_pixels[y * width] :
+			&context.rgba[y * width * 4];
+	}
+
+	if(setjmp(png_jmpbuf(png_ptr))) {
+		err << "Error reading PNG image of file "
+			<< filename << "." << std::endl;
 		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-		fclose(png_file);
-
-		// Compress XYZ data
-		comp_size = compressBound(768 + width * height);
-		comp_data = new Bytef[comp_size];
-
-		int errorcode = compress2(comp_data, &comp_size, xyz_data,
-			768 + width * height, Z_BEST_COMPRESSION);
-		delete[] xyz_data;
-		if(errorcode != Z_OK) {
-			std::cerr << "Error while compressing XYZ data from "
-				<< argv[arg] << "." << std::endl;
-			delete[] comp_data;
-			return 1;
+		return false;
+	}
+	png_set_interlace_handling(png_ptr);
+	png_read_image(png_ptr, row_pointers.data());
+
+	// Release libpng
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+	if(!indexed) {
+		Quantizer& quantizer = context.quantizer;
+		quantizer.SetDithering(options.dither);
+		if(options.has_key) {
+			quantizer.SetKeyColor(options.key_color);
+		}
+		quantizer.Quantize(context.rgba.data(), width, height,
+			context.image.data(), xyz_pixels);
+	}
+
+	if(!WriteXyzFile(xyz_header, filename, xyz_filename, options, context,
+		err)) {
+		return false;
+	}
+
+	if(manifest != NULL) {
+		manifest->Update(filename, xyz_filename, options.manifest_settings,
+			hash, size);
+	}
+	return true;
+}
+
+bool ConvertBmpFile(const std::string& filename,
+	const Xyz::InputFile& bmp_file, const std::string& xyz_filename,
+	const Options& options, WorkerContext& context, std::ostream& err) {
+	bool to_stdout = xyz_filename == "-";
+
+	BmpReader reader;
+	if(!reader.Open(bmp_file.GetData(), bmp_file.GetSize())) {
+		err << "BMP file " << filename << " "
+			<< reader.GetError() << "." << std::endl;
+		return false;
+	}
+
+	Xyz::Header xyz_header;
+	xyz_header.width = reader.GetWidth();
+	xyz_header.height = reader.GetHeight();
+
+	// Uncompressed rows are deflated from the file unless the parallel
+	// encoder, the round trip check or the palette optimization need them
+	// in one buffer
+	bool direct = !reader.IsCompressed() && options.block_pool == NULL
+		&& !options.verify && !options.optimize_palette;
+	size_t pixels_size = direct ? 0 : Xyz::GetPixelsSize(xyz_header);
+	context.image.resize(Xyz::PaletteSize + pixels_size);
+	unsigned char* xyz_pixels = context.image.data() + Xyz::PaletteSize;
+	reader.GetPalette(context.image.data());
+
+	if(!direct) {
+		if(reader.IsCompressed()) {
+			if(!reader.Decompress(xyz_pixels)) {
+				err << "BMP file " << filename << " "
+					<< reader.GetError() << "." << std::endl;
+				return false;
+			}
+		} else {
+			for(size_t y = 0; y < xyz_header.height; y++) {
+				memcpy(&xyz_pixels[y * xyz_header.width], reader.GetRow(y),
+					xyz_header.width);
+			}
 		}
+		return WriteXyzFile(xyz_header, filename, xyz_filename, options,
+			context, err);
+	}
 
-		std::stringstream ss;
-		ss << GetFilename(argv[arg]) + std::string(".xyz");
-		xyz_filename = ss.str();
-		std::ofstream xyz_file(xyz_filename.c_str(), std::ofstream::binary);
-		xyz_file.write("XYZ1", 4);
-		xyz_file.write(reinterpret_cast<char*>(&width), 2);
-		xyz_file.write(reinterpret_cast<char*>(&height), 2);
-		xyz_file.write(reinterpret_cast<char*>(comp_data), comp_size);
+	std::ofstream xyz_file;
+	if(to_stdout) {
+		Xyz::SetBinaryMode(stdout);
+	} else {
+		xyz_file.open(xyz_filename.c_str(), std::ofstream::binary);
+	}
+	std::ostream& xyz_out = to_stdout ? std::cout : xyz_file;
+	Xyz::Encoder& encoder = context.encoder;
+
+	Xyz::Result result = encoder.Begin(xyz_header, xyz_out,
+		Z_BEST_COMPRESSION);
+	if(result == Xyz::Ok) {
+		result = encoder.WritePalette(context.image.data(),
+			options.split_palette);
+	}
+	for(size_t y = 0; y < xyz_header.height && result == Xyz::Ok; y++) {
+		result = encoder.WriteRow(reader.GetRow(y));
+	}
+	if(result == Xyz::Ok) {
+		result = encoder.Finish();
+	}
+
+	if(to_stdout) {
+		xyz_out.flush();
+	} else {
 		xyz_file.close();
-		delete[] comp_data;
+	}
+	if(result != Xyz::Ok || !xyz_out) {
+		err << "Error while writing XYZ file "
+			<< xyz_filename << "." << std::endl;
+		if(!to_stdout) {
+			remove(xyz_filename.c_str());
+		}
+		return false;
+	}
+	return true;
+}
+
+bool WriteXyzFile(const Xyz::Header& header, const std::string& filename,
+	const std::string& xyz_filename, const Options& options,
+	WorkerContext& context, std::ostream& err) {
+	bool to_stdout = xyz_filename == "-";
+	unsigned char* xyz_palette = context.image.data();
+	unsigned char* xyz_pixels = xyz_palette + Xyz::PaletteSize;
+
+	if(options.optimize_palette) {
+		Xyz::OptimizePalette(xyz_palette, xyz_pixels,
+			Xyz::GetPixelsSize(header));
+	}
+
+	// Compress XYZ data
+	size_t xyz_size = Xyz::GetEncodeBound(header);
+	std::vector<unsigned char>& xyz_data = context.xyz_data;
+	xyz_data.resize(xyz_size);
+
+	Xyz::Result result;
+	if(options.split_palette) {
+		result = Xyz::EncodeSplit(header, xyz_palette, xyz_pixels,
+			xyz_data.data(), xyz_size, Z_BEST_COMPRESSION);
+	} else if(options.block_pool == NULL) {
+		result = Xyz::Encode(header, xyz_palette, xyz_pixels,
+			xyz_data.data(), xyz_size, Z_BEST_COMPRESSION);
+	} else {
+		result = Xyz::EncodeParallel(header, xyz_palette, xyz_pixels,
+			xyz_data.data(), xyz_size, *options.block_pool,
+			Z_BEST_COMPRESSION);
+	}
+	if(result != Xyz::Ok) {
+		err << "Error while compressing XYZ data from "
+			<< filename << ": "
+			<< Xyz::GetResultString(result) << "." << std::endl;
+		return false;
+	}
+
+	// Nothing is written when the check fails
+	if(options.verify && !VerifyXyzData(header, xyz_size, context)) {
+		err << "Verification of XYZ data from "
+			<< filename << " failed: "
+			<< context.verify.result << "." << std::endl;
+		return false;
+	}
+
+	std::ofstream xyz_file;
+	if(to_stdout) {
+		Xyz::SetBinaryMode(stdout);
+	} else {
+		xyz_file.open(xyz_filename.c_str(), std::ofstream::binary);
+	}
+	std::ostream& xyz_out = to_stdout ? std::cout : xyz_file;
+	xyz_out.write(reinterpret_cast<char*>(xyz_data.data()), xyz_size);
+	if(to_stdout) {
+		xyz_out.flush();
+	} else {
+		xyz_file.close();
+	}
+	if(!xyz_out) {
+		err << "Error while writing XYZ file "
+			<< xyz_filename << "." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	options.jobs = 1;
+	options.block_pool = NULL;
+	unsigned threads = 1;
+	options.stream = false;
+	options.manifest = NULL;
+	options.dither = false;
+	options.has_key = false;
+	options.verify = false;
+	options.optimize_palette = false;
+	options.split_palette = false;
+	std::string manifest_filename;
+	std::string output_dir;
+	bool recursive = false;
+	int arg = 1;
+
+	for(; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; arg++) {
+		std::string option = argv[arg];
+		if(option == "--") {
+			arg++;
+			break;
+		} else if(option.compare(0, 2, "-a") == 0) {
+			std::string value = option.substr(2);
+			if(value.empty() && arg + 1 < argc) {
+				value = argv[++arg];
+			}
+			if(!ParseColor(value, options.key_color)) {
+				std::cerr << "Invalid color '" << value
+					<< "'." << std::endl;
+				return 1;
+			}
+			options.has_key = true;
+		} else if(option.compare(0, 2, "-b") == 0) {
+			std::string value = option.substr(2);
+			if(value.empty() && arg + 1 < argc) {
+				value = argv[++arg];
+			}
+			if(!Xyz::WorkerPool::ParseSize(value, threads)) {
+				std::cerr << "Invalid thread count '" << value
+					<< "', use 0 (one per CPU) to "
+					<< Xyz::WorkerPool::GetMaxSize() << "." << std::endl;
+				return 1;
+			}
+		} else if(option == "-d") {
+			options.dither = true;
+		} else if(option.compare(0, 2, "-j") == 0) {
+			std::string value = option.substr(2);
+			if(value.empty() && arg + 1 < argc) {
+				value = argv[++arg];
+			}
+			if(!Xyz::WorkerPool::ParseSize(value, options.jobs)) {
+				std::cerr << "Invalid job count '" << value
+					<< "', use 0 (one per CPU) to "
+					<< Xyz::WorkerPool::GetMaxSize() << "." << std::endl;
+				return 1;
+			}
+		} else if(option.compare(0, 2, "-m") == 0) {
+			manifest_filename = option.substr(2);
+			if(manifest_filename.empty() && arg + 1 < argc) {
+				manifest_filename = argv[++arg];
+			}
+			if(manifest_filename.empty()) {
+				std::cerr << "Missing manifest filename." << std::endl;
+				return 1;
+			}
+		} else if(option == "-n") {
+			options.optimize_palette = true;
+		} else if(option.compare(0, 2, "-o") == 0) {
+			output_dir = option.substr(2);
+			if(output_dir.empty() && arg + 1 < argc) {
+				output_dir = argv[++arg];
+			}
+			if(output_dir.empty()) {
+				std::cerr << "Missing output directory." << std::endl;
+				return 1;
+			}
+		} else if(option == "-r") {
+			recursive = true;
+		} else if(option == "-s") {
+			options.stream = true;
+		} else if(option == "-v") {
+			options.verify = true;
+		} else if(option == "-w") {
+			options.split_palette = true;
+		} else {
+			std::cerr << "Unknown option " << option << "."
+				<< std::endl;
+			return 1;
+		}
+	}
+
+	if(arg >= argc)
+	{
+		std::cout << "Usage: " << argv[0]
+			<< " [-a color] [-b threads] [-d] [-j jobs] [-m manifest] [-n]"
+			<< " [-o dir] [-r] [-s] [-v] [-w] filename [... filenameN]"
+			<< std::endl
+			<< std::endl
+			<< "  -a color     transparent color (rrggbb) of truecolor images,"
+			<< " mapped to index 0" << std::endl
+			<< "  -b threads   deflate each image in blocks on this many"
+			<< " threads (0: one per CPU)" << std::endl
+			<< "  -d           dither truecolor images when reducing them to"
+			<< " 256 colors" << std::endl
+			<< "  -j jobs      convert this many files in parallel"
+			<< " (0: one per CPU)" << std::endl
+			<< "  -m manifest  skip files that are unchanged since the last"
+			<< " run with this manifest" << std::endl
+			<< "  -n           merge duplicate palette colors, sort the"
+			<< " palette by use and clear" << std::endl
+			<< "               unused entries, index 0 stays the"
+			<< " transparent color" << std::endl
+			<< "  -o dir       write the output files into this directory"
+			<< std::endl
+			<< "  -r           convert all PNG and BMP files in the"
+			<< " given directories and their" << std::endl
+			<< "               subdirectories, the directory structure is"
+			<< " mirrored in the output" << std::endl
+			<< "  -s           stream rows, memory use does not depend on"
+			<< " the image size" << std::endl
+			<< "  -v           inflate every file again before writing it and"
+			<< " compare it to the" << std::endl
+			<< "               image, prints one line per file: result,"
+			<< " width, height, XYZ size," << std::endl
+			<< "               filename" << std::endl
+			<< "  -w           compress the palette separately, so"
+			<< " xyzcrush -s can replace it" << std::endl
+			<< "               without touching the pixels (-b is ignored)"
+			<< std::endl
+			<< std::endl
+			<< "A filename of - converts standard input to standard output."
+			<< std::endl;
+		return 1;
+	}
+
+	// Quantization and palette options change the output
+	std::ostringstream settings;
+	settings << "xyz";
+	if(options.optimize_palette) {
+		settings << " palette";
+	}
+	if(options.split_palette) {
+		settings << " split";
+	}
+	if(options.dither) {
+		settings << " dither";
+	}
+	if(threads != 1 && !options.split_palette) {
+		settings << " blocks";
+	}
+	if(options.has_key) {
+		settings << " key=" << std::hex;
+		for(int i = 0; i < 3; i++) {
+			settings << (options.key_color[i] >> 4)
+				<< (options.key_color[i] & 0xF);
+		}
+	}
+	settings << " backend=" << Xyz::GetBackendName(Xyz::GetBackend());
+	options.manifest_settings = settings.str();
+
+	Xyz::Manifest manifest;
+	if(!manifest_filename.empty()) {
+		if(!manifest.Load(manifest_filename)) {
+			std::cerr << "Error reading manifest "
+				<< manifest_filename << "." << std::endl;
+			return 1;
+		}
+		options.manifest = &manifest;
+	}
+
+	// One pool deflates the blocks of all images, the -j jobs share it,
+	// a split palette needs a single zlib stream
+	std::unique_ptr<Xyz::WorkerPool> block_pool;
+	if(threads != 1 && !options.split_palette) {
+		block_pool.reset(new Xyz::WorkerPool(threads));
+		options.block_pool = block_pool.get();
+	}
+
+	// The verification report must not mix with XYZ data on stdout
+	bool any_stdout = false;
+	for(int i = arg; i < argc; i++) {
+		any_stdout = any_stdout || std::string(argv[i]) == "-";
+	}
+	std::ostream& report = any_stdout ? std::cerr : std::cout;
+
+	std::mutex output_mutex;
+	int failed = 0;
+	int total = 0;
+	int verified = 0;
+	int verify_failed = 0;
+	bool walk_failed = false;
+
+	// Source of every output file, e.g. a.png and a.bmp both give a.xyz
+	std::map<std::string, std::string> sources;
+
+	{
+		Xyz::WorkerPool pool(options.jobs);
+
+		auto submit = [&](const std::string& filename,
+			const std::string& out_filename) {
+			total++;
+			std::pair<std::map<std::string, std::string>::iterator, bool>
+				inserted = sources.insert(std::make_pair(out_filename,
+				filename));
+			if(!inserted.second) {
+				std::lock_guard<std::mutex> lock(output_mutex);
+				std::cerr << "Skipping " << filename << ", "
+					<< inserted.first->second << " is converted to "
+					<< out_filename << " already." << std::endl;
+				failed++;
+				return;
+			}
+
+			pool.Submit([filename, out_filename, &options, &output_mutex,
+				&failed, &report, &verified, &verify_failed]() {
+				std::ostringstream err;
+				thread_local WorkerContext context;
+				bool success = ConvertFile(filename, out_filename, options,
+					context, err);
+				context.input.Close();
+
+				std::lock_guard<std::mutex> lock(output_mutex);
+				const VerifyReport& verify = context.verify;
+				if(verify.checked) {
+					report << verify.result << "\t" << verify.header.width
+						<< "\t" << verify.header.height << "\t"
+						<< verify.xyz_size << "\t" << filename << "\n";
+					verified++;
+					if(strcmp(verify.result, "ok") != 0) {
+						verify_failed++;
+					}
+				}
+				std::cerr << err.str();
+				if(!success) {
+					failed++;
+				}
+			});
+		};
+
+		for(; arg < argc; arg++) {
+			std::string filename = argv[arg];
+
+			// Standard input is converted to standard output
+			if(filename == "-") {
+				submit(filename, filename);
+				continue;
+			}
+
+			if(!recursive) {
+				submit(filename, GetOutputFilename(output_dir,
+					GetFilename(filename) + ".xyz"));
+				continue;
+			}
+
+			// Files are converted while the tree is still being walked
+			bool walked = Xyz::WalkDirectory(filename, "",
+				[&](const std::string& relative) {
+				if(!HasExtension(relative, ".png")
+					&& !HasExtension(relative, ".bmp")) {
+					return;
+				}
+				submit(filename + "/" + relative, GetOutputFilename(output_dir,
+					relative.substr(0, relative.size() - 4) + ".xyz"));
+			});
+			if(!walked) {
+				std::lock_guard<std::mutex> lock(output_mutex);
+				std::cerr << "Error reading directory "
+					<< filename << "." << std::endl;
+				walk_failed = true;
+			}
+		}
+
+		pool.Wait();
+	}
+
+	if(options.manifest != NULL && !manifest.Save(manifest_filename)) {
+		std::cerr << "Error writing manifest "
+			<< manifest_filename << "." << std::endl;
+		return 1;
+	}
+
+	if(options.verify) {
+		report << "Verified " << verified << " files, "
+			<< verify_failed << " failed." << std::endl;
+	}
+
+	if(failed > 0) {
+		std::cerr << failed << " of " << total
+			<< " files failed to convert." << std::endl;
+		return 1;
 	}
 
-	return 0;
+	return walk_failed ? 1 : 0;
 }
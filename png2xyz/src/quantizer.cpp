@@ -0,0 +1,375 @@
+/*
+ * This file is part of png2xyz. Copyright (c) 2015 png2xyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "quantizer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+	/** Number of k-means passes after the median cut. */
+	const int refine_passes = 3;
+
+	/** Returns the 15 bit histogram bin of a color. */
+	inline int GetBin(int r, int g, int b) {
+		return ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+	}
+
+	/** Returns a channel of a histogram bin. */
+	inline int GetBinChannel(int bin, int channel) {
+		return (bin >> (10 - channel * 5)) & 0x1F;
+	}
+
+	inline int Clamp(int value) {
+		return value < 0 ? 0 : (value > 255 ? 255 : value);
+	}
+
+	/** A range of histogram bins of the median cut. */
+	struct Box {
+		size_t begin;
+		size_t end;
+		unsigned long long count;
+		int axis;
+		double error;
+	};
+}
+
+Quantizer::Quantizer() : has_key(false), dithering(false), colors(0),
+	histogram_count(1 << 15), histogram_sum(3 << 15),
+	nearest_cache(1 << 15) {
+	key[0] = key[1] = key[2] = 0;
+}
+
+void Quantizer::SetKeyColor(const unsigned char* color) {
+	has_key = true;
+	memcpy(key, color, 3);
+}
+
+void Quantizer::SetDithering(bool dithering) {
+	this->dithering = dithering;
+}
+
+bool Quantizer::IsTransparent(const unsigned char* pixel) const {
+	return pixel[3] < 128 || (has_key && pixel[0] == key[0] &&
+		pixel[1] == key[1] && pixel[2] == key[2]);
+}
+
+void Quantizer::Quantize(const unsigned char* rgba, size_t width,
+	size_t height, unsigned char* palette, unsigned char* pixels) {
+	size_t count = width * height;
+
+	// Color key, the first transparent pixel defines it without a key color
+	memset(palette, 0, 768);
+	if(has_key) {
+		memcpy(palette, key, 3);
+	} else {
+		for(size_t i = 0; i < count; i++) {
+			if(IsTransparent(&rgba[i * 4])) {
+				memcpy(palette, &rgba[i * 4], 3);
+				break;
+			}
+		}
+	}
+
+	bool exact = FindExactColors(rgba, count);
+	if(!exact) {
+		BuildHistogram(rgba, count);
+		MedianCut();
+		Refine();
+	}
+
+	for(int i = 0; i < colors; i++) {
+		palette[(i + 1) * 3] = palette_r[i];
+		palette[(i + 1) * 3 + 1] = palette_g[i];
+		palette[(i + 1) * 3 + 2] = palette_b[i];
+	}
+
+	std::fill(nearest_cache.begin(), nearest_cache.end(), -1);
+	if(!exact && dithering) {
+		MapDithered(rgba, width, height, pixels);
+	} else {
+		Map(rgba, width, height, pixels);
+	}
+}
+
+bool Quantizer::FindExactColors(const unsigned char* rgba, size_t count) {
+	exact_colors.clear();
+	colors = 0;
+
+	unsigned last = 0xFFFFFFFF;
+	for(size_t i = 0; i < count; i++) {
+		const unsigned char* pixel = &rgba[i * 4];
+		if(IsTransparent(pixel)) {
+			continue;
+		}
+
+		unsigned color = (pixel[0] << 16) | (pixel[1] << 8) | pixel[2];
+		if(color == last || exact_colors.count(color) != 0) {
+			last = color;
+			continue;
+		}
+		if(colors == 255) {
+			exact_colors.clear();
+			colors = 0;
+			return false;
+		}
+
+		exact_colors[color] = colors;
+		palette_r[colors] = pixel[0];
+		palette_g[colors] = pixel[1];
+		palette_b[colors] = pixel[2];
+		colors++;
+		last = color;
+	}
+
+	return true;
+}
+
+void Quantizer::BuildHistogram(const unsigned char* rgba, size_t count) {
+	std::fill(histogram_count.begin(), histogram_count.end(), 0);
+	std::fill(histogram_sum.begin(), histogram_sum.end(), 0);
+
+	for(size_t i = 0; i < count; i++) {
+		const unsigned char* pixel = &rgba[i * 4];
+		if(IsTransparent(pixel)) {
+			continue;
+		}
+
+		int bin = GetBin(pixel[0], pixel[1], pixel[2]);
+		histogram_count[bin]++;
+		histogram_sum[bin * 3] += pixel[0];
+		histogram_sum[bin * 3 + 1] += pixel[1];
+		histogram_sum[bin * 3 + 2] += pixel[2];
+	}
+
+	bins.clear();
+	for(int bin = 0; bin < (1 << 15); bin++) {
+		if(histogram_count[bin] > 0) {
+			bins.push_back(bin);
+		}
+	}
+}
+
+void Quantizer::MedianCut() {
+	std::vector<Box> boxes;
+
+	// Computes count, squared error and the axis of largest variance
+	auto measure = [this](Box& box) {
+		double sum[3] = { 0, 0, 0 };
+		double squares[3] = { 0, 0, 0 };
+		box.count = 0;
+		for(size_t i = box.begin; i < box.end; i++) {
+			int bin = bins[i];
+			unsigned count = histogram_count[bin];
+			box.count += count;
+			for(int c = 0; c < 3; c++) {
+				double value = histogram_sum[bin * 3 + c];
+				sum[c] += value;
+				squares[c] += value * value / count;
+			}
+		}
+		double variance[3];
+		for(int c = 0; c < 3; c++) {
+			variance[c] = squares[c] - sum[c] * sum[c] / box.count;
+		}
+		box.axis = 0;
+		for(int c = 1; c < 3; c++) {
+			if(variance[c] > variance[box.axis]) {
+				box.axis = c;
+			}
+		}
+		box.error = variance[0] + variance[1] + variance[2];
+	};
+
+	if(!bins.empty()) {
+		Box box = { 0, bins.size(), 0, 0, 0 };
+		measure(box);
+		boxes.push_back(box);
+	}
+
+	while(boxes.size() < 255) {
+		// Split the box with the largest squared error
+		int selected = -1;
+		double best_error = -1;
+		for(size_t i = 0; i < boxes.size(); i++) {
+			if(boxes[i].end - boxes[i].begin > 1 &&
+				boxes[i].error > best_error) {
+				selected = i;
+				best_error = boxes[i].error;
+			}
+		}
+		if(selected < 0) {
+			break;
+		}
+
+		Box& box = boxes[selected];
+		int axis = box.axis;
+		std::sort(bins.begin() + box.begin, bins.begin() + box.end,
+			[axis](int a, int b) {
+				return GetBinChannel(a, axis) < GetBinChannel(b, axis);
+			});
+
+		// Split at the pixel median, keeping both halves non empty
+		unsigned long long half = box.count / 2;
+		unsigned long long sum = 0;
+		size_t split = box.begin;
+		while(split < box.end - 1 && sum + histogram_count[bins[split]]
+			<= half) {
+			sum += histogram_count[bins[split]];
+			split++;
+		}
+		if(split == box.begin) {
+			split++;
+		}
+
+		Box upper = { split, box.end, 0, 0, 0 };
+		box.end = split;
+		measure(box);
+		measure(upper);
+		boxes.push_back(upper);
+	}
+
+	// Palette entries are the mean colors of the boxes
+	colors = boxes.size();
+	for(int i = 0; i < colors; i++) {
+		unsigned long long sum[3] = { 0, 0, 0 };
+		for(size_t j = boxes[i].begin; j < boxes[i].end; j++) {
+			for(int c = 0; c < 3; c++) {
+				sum[c] += histogram_sum[bins[j] * 3 + c];
+			}
+		}
+		palette_r[i] = (sum[0] + boxes[i].count / 2) / boxes[i].count;
+		palette_g[i] = (sum[1] + boxes[i].count / 2) / boxes[i].count;
+		palette_b[i] = (sum[2] + boxes[i].count / 2) / boxes[i].count;
+	}
+}
+
+void Quantizer::Refine() {
+	std::vector<unsigned long long> sums(colors * 4);
+
+	for(int pass = 0; pass < refine_passes; pass++) {
+		std::fill(sums.begin(), sums.end(), 0);
+
+		// Assign the mean color of every bin to its nearest entry
+		for(size_t i = 0; i < bins.size(); i++) {
+			int bin = bins[i];
+			unsigned count = histogram_count[bin];
+			int nearest = FindNearest(histogram_sum[bin * 3] / count,
+				histogram_sum[bin * 3 + 1] / count,
+				histogram_sum[bin * 3 + 2] / count);
+			sums[nearest * 4] += histogram_sum[bin * 3];
+			sums[nearest * 4 + 1] += histogram_sum[bin * 3 + 1];
+			sums[nearest * 4 + 2] += histogram_sum[bin * 3 + 2];
+			sums[nearest * 4 + 3] += count;
+		}
+
+		for(int i = 0; i < colors; i++) {
+			unsigned long long count = sums[i * 4 + 3];
+			if(count > 0) {
+				palette_r[i] = (sums[i * 4] + count / 2) / count;
+				palette_g[i] = (sums[i * 4 + 1] + count / 2) / count;
+				palette_b[i] = (sums[i * 4 + 2] + count / 2) / count;
+			}
+		}
+	}
+}
+
+int Quantizer::FindNearest(int r, int g, int b) const {
+	// Separate channel arrays let the compiler vectorize the distances
+	int distances[256];
+	for(int i = 0; i < colors; i++) {
+		int dr = palette_r[i] - r;
+		int dg = palette_g[i] - g;
+		int db = palette_b[i] - b;
+		distances[i] = dr * dr + dg * dg + db * db;
+	}
+
+	int nearest = 0;
+	for(int i = 1; i < colors; i++) {
+		if(distances[i] < distances[nearest]) {
+			nearest = i;
+		}
+	}
+	return nearest;
+}
+
+int Quantizer::GetCachedNearest(int r, int g, int b) {
+	int bin = GetBin(r, g, b);
+	if(nearest_cache[bin] < 0) {
+		// Center of the bin, so the result does not depend on pixel order
+		nearest_cache[bin] = FindNearest((r & ~7) | 4, (g & ~7) | 4,
+			(b & ~7) | 4);
+	}
+	return nearest_cache[bin];
+}
+
+void Quantizer::Map(const unsigned char* rgba, size_t width, size_t height,
+	unsigned char* pixels) {
+	size_t count = width * height;
+	bool exact = !exact_colors.empty() || colors == 0;
+
+	for(size_t i = 0; i < count; i++) {
+		const unsigned char* pixel = &rgba[i * 4];
+		if(IsTransparent(pixel)) {
+			pixels[i] = 0;
+		} else if(exact) {
+			unsigned color = (pixel[0] << 16) | (pixel[1] << 8) | pixel[2];
+			pixels[i] = exact_colors[color] + 1;
+		} else {
+			pixels[i] = GetCachedNearest(pixel[0], pixel[1], pixel[2]) + 1;
+		}
+	}
+}
+
+void Quantizer::MapDithered(const unsigned char* rgba, size_t width,
+	size_t height, unsigned char* pixels) {
+	// Errors in 1/16, with one pixel of padding on both sides
+	size_t stride = (width + 2) * 3;
+	errors.assign(stride * 2, 0);
+	int* current = &errors[0];
+	int* next = &errors[stride];
+
+	for(size_t y = 0; y < height; y++) {
+		std::fill(next, next + stride, 0);
+
+		for(size_t x = 0; x < width; x++) {
+			const unsigned char* pixel = &rgba[(y * width + x) * 4];
+			if(IsTransparent(pixel)) {
+				pixels[y * width + x] = 0;
+				continue;
+			}
+
+			int* error = &current[(x + 1) * 3];
+			int r = Clamp(pixel[0] + error[0] / 16);
+			int g = Clamp(pixel[1] + error[1] / 16);
+			int b = Clamp(pixel[2] + error[2] / 16);
+
+			int nearest = GetCachedNearest(r, g, b);
+			pixels[y * width + x] = nearest + 1;
+
+			int diff[3] = { r - palette_r[nearest], g - palette_g[nearest],
+				b - palette_b[nearest] };
+			for(int c = 0; c < 3; c++) {
+				current[(x + 2) * 3 + c] += diff[c] * 7;
+				next[x * 3 + c] += diff[c] * 3;
+				next[(x + 1) * 3 + c] += diff[c] * 5;
+				next[(x + 2) * 3 + c] += diff[c];
+			}
+		}
+
+		std::swap(current, next);
+	}
+}
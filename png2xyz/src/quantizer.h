@@ -0,0 +1,97 @@
+/*
+ * This file is part of png2xyz. Copyright (c) 2015 png2xyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PNG2XYZ_QUANTIZER_H
+#define PNG2XYZ_QUANTIZER_H
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Reduces a RGBA image to the 256 color palette of a XYZ file.
+ *
+ * Palette index 0 is the color key: all transparent pixels (alpha below
+ * 128) and all pixels of the key color are mapped to it, no other pixel
+ * is. Images with at most 255 other colors keep their exact colors.
+ * Otherwise the other 255 entries are chosen by median cut over a 15 bit
+ * color histogram and refined by a few k-means passes over the histogram.
+ *
+ * A quantizer keeps its buffers between images, use one per thread.
+ */
+class Quantizer {
+public:
+	Quantizer();
+
+	/** Maps pixels of this RGB color to index 0, like transparent ones. */
+	void SetKeyColor(const unsigned char* color);
+
+	/** Enables Floyd-Steinberg dithering when colors are reduced. */
+	void SetDithering(bool dithering);
+
+	/**
+	 * Quantizes an image.
+	 *
+	 * @param rgba width * height pixels of 4 bytes, rows top to bottom
+	 * @param width image width
+	 * @param height image height
+	 * @param palette receives 768 bytes of RGB palette
+	 * @param pixels receives width * height palette indices
+	 */
+	void Quantize(const unsigned char* rgba, size_t width, size_t height,
+		unsigned char* palette, unsigned char* pixels);
+
+private:
+	Quantizer(const Quantizer&);
+	Quantizer& operator=(const Quantizer&);
+
+	bool IsTransparent(const unsigned char* pixel) const;
+	bool FindExactColors(const unsigned char* rgba, size_t count);
+	void BuildHistogram(const unsigned char* rgba, size_t count);
+	void MedianCut();
+	void Refine();
+	int FindNearest(int r, int g, int b) const;
+	int GetCachedNearest(int r, int g, int b);
+	void Map(const unsigned char* rgba, size_t width, size_t height,
+		unsigned char* pixels);
+	void MapDithered(const unsigned char* rgba, size_t width, size_t height,
+		unsigned char* pixels);
+
+	bool has_key;
+	unsigned char key[3];
+	bool dithering;
+
+	/** Colors of entries 1 to 255 as separate channels. */
+	int palette_r[256];
+	int palette_g[256];
+	int palette_b[256];
+	int colors;
+
+	/** Pixel count and channel sums per 15 bit color. */
+	std::vector<unsigned> histogram_count;
+	std::vector<unsigned long long> histogram_sum;
+	/** Used histogram bins. */
+	std::vector<int> bins;
+	/** Nearest palette entry per 15 bit color, -1 when unknown. */
+	std::vector<short> nearest_cache;
+	/** Palette entry of each color as 0xRRGGBB, when at most 255. */
+	std::unordered_map<unsigned, int> exact_colors;
+	/** Diffused errors of the current and the next row. */
+	std::vector<int> errors;
+};
+
+#endif
@@ -0,0 +1,253 @@
+/*
+ * This file is part of png2xyz. Copyright (c) 2015 png2xyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Builds BMP files in memory, uncompressed bottom up and top down, RLE8
+ * compressed and with OS/2 headers, and checks the rows and palette read
+ * back. Broken files must be rejected.
+ */
+
+#include "bmp_reader.h"
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+	int failures = 0;
+
+	void Check(bool condition, const std::string& what) {
+		if(!condition) {
+			std::cerr << "FAIL: " << what << std::endl;
+			failures++;
+		}
+	}
+
+	void StoreLittleEndian(std::vector<unsigned char>& out, size_t offset,
+		unsigned long value, int bytes) {
+		for(int i = 0; i < bytes; i++) {
+			out[offset + i] = (value >> (i * 8)) & 0xFF;
+		}
+	}
+
+	/** Test image, 5 wide so uncompressed rows need padding. */
+	const unsigned short Width = 5;
+	const unsigned short Height = 3;
+
+	unsigned char GetPixel(size_t x, size_t y) {
+		return static_cast<unsigned char>(y * 16 + x + 1);
+	}
+
+	/**
+	 * Builds a BMP file with a BITMAPINFOHEADER, or the OS/2 header with
+	 * 3 byte palette entries. The palette has entries entries where entry
+	 * i is (i, 255 - i, i / 2). Rows are stored uncompressed unless rle
+	 * holds RLE8 data.
+	 */
+	std::vector<unsigned char> MakeBmp(bool os2, bool top_down,
+		size_t entries, const std::vector<unsigned char>& rle) {
+		size_t header_size = os2 ? 12 : 40;
+		size_t entry_size = os2 ? 3 : 4;
+		size_t stride = (Width + 3) & ~3;
+		size_t offset = 14 + header_size + entries * entry_size;
+		size_t pixels_size = rle.empty() ? stride * Height : rle.size();
+
+		std::vector<unsigned char> bmp(offset + pixels_size);
+		bmp[0] = 'B';
+		bmp[1] = 'M';
+		StoreLittleEndian(bmp, 2, bmp.size(), 4);
+		StoreLittleEndian(bmp, 10, offset, 4);
+		StoreLittleEndian(bmp, 14, header_size, 4);
+		if(os2) {
+			StoreLittleEndian(bmp, 18, Width, 2);
+			StoreLittleEndian(bmp, 20, Height, 2);
+			StoreLittleEndian(bmp, 22, 1, 2);
+			StoreLittleEndian(bmp, 24, 8, 2);
+		} else {
+			long height = top_down ? -(long) Height : Height;
+			StoreLittleEndian(bmp, 18, Width, 4);
+			StoreLittleEndian(bmp, 22, (unsigned long) height, 4);
+			StoreLittleEndian(bmp, 26, 1, 2);
+			StoreLittleEndian(bmp, 28, 8, 2);
+			StoreLittleEndian(bmp, 30, rle.empty() ? 0 : 1, 4);
+			StoreLittleEndian(bmp, 46, entries == 256 ? 0 : entries, 4);
+		}
+
+		for(size_t i = 0; i < entries; i++) {
+			unsigned char* entry = &bmp[14 + header_size + i * entry_size];
+			entry[0] = i / 2;
+			entry[1] = 255 - i;
+			entry[2] = i;
+		}
+
+		if(!rle.empty()) {
+			memcpy(&bmp[offset], rle.data(), rle.size());
+			return bmp;
+		}
+		for(size_t y = 0; y < Height; y++) {
+			size_t file_y = top_down ? y : Height - 1 - y;
+			for(size_t x = 0; x < Width; x++) {
+				bmp[offset + file_y * stride + x] = GetPixel(x, y);
+			}
+		}
+		return bmp;
+	}
+
+	/** Checks that entries palette entries were read and the rest is black. */
+	void CheckPalette(const BmpReader& reader, size_t entries,
+		const std::string& what) {
+		unsigned char palette[768];
+		reader.GetPalette(palette);
+		bool ok = true;
+		for(size_t i = 0; i < 256; i++) {
+			bool used = i < entries;
+			ok = ok && palette[i * 3] == (used ? i : 0)
+				&& palette[i * 3 + 1] == (used ? 255 - i : 0)
+				&& palette[i * 3 + 2] == (used ? i / 2 : 0);
+		}
+		Check(ok, what + ": palette");
+	}
+
+	/** Opens an uncompressed BMP and compares its rows. */
+	void CheckRows(bool os2, bool top_down, size_t entries,
+		const std::string& what) {
+		std::vector<unsigned char> bmp = MakeBmp(os2, top_down, entries,
+			std::vector<unsigned char>());
+		BmpReader reader;
+		if(!reader.Open(bmp.data(), bmp.size())) {
+			Check(false, what + ": open, " + reader.GetError());
+			return;
+		}
+		Check(reader.GetWidth() == Width && reader.GetHeight() == Height,
+			what + ": dimensions");
+		Check(!reader.IsCompressed(), what + ": not compressed");
+		bool rows_ok = true;
+		for(size_t y = 0; y < Height; y++) {
+			const unsigned char* row = reader.GetRow(y);
+			for(size_t x = 0; x < Width; x++) {
+				rows_ok = rows_ok && row[x] == GetPixel(x, y);
+			}
+		}
+		Check(rows_ok, what + ": rows");
+		CheckPalette(reader, entries, what);
+	}
+
+	/** Returns whether Open rejects a file. */
+	bool IsRejected(const std::vector<unsigned char>& bmp) {
+		BmpReader reader;
+		return !reader.Open(bmp.data(), bmp.size());
+	}
+
+	/** Opens and decompresses a RLE8 BMP, returns false on errors. */
+	bool Decompress(const std::vector<unsigned char>& rle,
+		std::vector<unsigned char>& pixels) {
+		std::vector<unsigned char> bmp = MakeBmp(false, false, 256, rle);
+		BmpReader reader;
+		if(!reader.Open(bmp.data(), bmp.size()) || !reader.IsCompressed()) {
+			return false;
+		}
+		pixels.assign((size_t) Width * Height, 0xFF);
+		return reader.Decompress(pixels.data());
+	}
+}
+
+int main() {
+	CheckRows(false, false, 256, "bottom up");
+	CheckRows(false, true, 256, "top down");
+	CheckRows(false, false, 16, "16 colors");
+	CheckRows(true, false, 256, "OS/2 header");
+
+	// Rows are stored bottom up: encoded runs, an absolute run with
+	// padding, a delta that skips pixels and the end of bitmap marker
+	const unsigned char rle_data[] = {
+		5, GetPixel(0, 2), 0, 0,
+		0, 3, GetPixel(0, 1), GetPixel(1, 1), GetPixel(2, 1), 0,
+		2, GetPixel(3, 1), 0, 0,
+		0, 2, 3, 0,
+		2, GetPixel(3, 0),
+		0, 1
+	};
+	std::vector<unsigned char> rle(rle_data, rle_data + sizeof(rle_data));
+	std::vector<unsigned char> pixels;
+	bool decompressed = Decompress(rle, pixels);
+	Check(decompressed, "RLE8: decompress");
+	std::vector<unsigned char> expected((size_t) Width * Height, 0);
+	for(size_t x = 0; x < Width; x++) {
+		expected[2 * Width + x] = GetPixel(0, 2);
+	}
+	for(size_t x = 0; x < 3; x++) {
+		expected[Width + x] = GetPixel(x, 1);
+	}
+	expected[Width + 3] = GetPixel(3, 1);
+	expected[Width + 4] = GetPixel(3, 1);
+	expected[3] = GetPixel(3, 0);
+	expected[4] = GetPixel(3, 0);
+	Check(decompressed && pixels == expected,
+		"RLE8: rows bottom up, skipped pixels get index 0");
+
+	// The end of bitmap marker may be missing after the last row
+	const unsigned char unterminated_data[] = {
+		5, 1, 0, 0, 5, 2, 0, 0, 5, 3, 0, 0
+	};
+	rle.assign(unterminated_data,
+		unterminated_data + sizeof(unterminated_data));
+	decompressed = Decompress(rle, pixels);
+	Check(decompressed && pixels[0] == 3 && pixels[Width] == 2
+		&& pixels[2 * Width] == 1, "RLE8: missing end marker");
+
+	const unsigned char overlong_data[] = { 6, 1, 0, 1 };
+	rle.assign(overlong_data, overlong_data + sizeof(overlong_data));
+	Check(!Decompress(rle, pixels), "RLE8: run past the row end fails");
+
+	const unsigned char short_data[] = { 0, 5, 1, 2 };
+	rle.assign(short_data, short_data + sizeof(short_data));
+	Check(!Decompress(rle, pixels), "RLE8: truncated absolute run fails");
+
+	const unsigned char missing_rows_data[] = { 5, 1, 0, 0 };
+	rle.assign(missing_rows_data,
+		missing_rows_data + sizeof(missing_rows_data));
+	Check(!Decompress(rle, pixels), "RLE8: missing rows fail");
+
+	// RLE8 can only be stored bottom up
+	rle.assign(rle_data, rle_data + sizeof(rle_data));
+	Check(IsRejected(MakeBmp(false, true, 256, rle)),
+		"RLE8 top down is rejected");
+
+	std::vector<unsigned char> bmp = MakeBmp(false, false, 256,
+		std::vector<unsigned char>());
+	std::vector<unsigned char> broken = bmp;
+	broken.resize(broken.size() - 1);
+	Check(IsRejected(broken), "truncated rows are rejected");
+	broken = bmp;
+	broken[28] = 24;
+	Check(IsRejected(broken), "24 bit is rejected");
+	broken = bmp;
+	broken[30] = 3;
+	Check(IsRejected(broken), "bitfields are rejected");
+	broken = bmp;
+	broken[0] = 'P';
+	Check(IsRejected(broken), "other signature is rejected");
+	broken = bmp;
+	StoreLittleEndian(broken, 18, 0, 4);
+	Check(IsRejected(broken), "zero width is rejected");
+
+	if(failures != 0) {
+		std::cerr << failures << " checks failed." << std::endl;
+		return 1;
+	}
+	return 0;
+}
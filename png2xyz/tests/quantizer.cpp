@@ -0,0 +1,175 @@
+/*
+ * This file is part of png2xyz. Copyright (c) 2015 png2xyz authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Quantizes images with few and with many colors and checks the palette
+ * size and that index 0 only receives transparent and key color pixels.
+ */
+
+#include "quantizer.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+	int failures = 0;
+
+	void Check(bool condition, const std::string& what) {
+		if(!condition) {
+			std::cerr << "FAIL: " << what << std::endl;
+			failures++;
+		}
+	}
+
+	void SetPixel(std::vector<unsigned char>& rgba, size_t i,
+		int r, int g, int b, int a) {
+		rgba[i * 4] = r;
+		rgba[i * 4 + 1] = g;
+		rgba[i * 4 + 2] = b;
+		rgba[i * 4 + 3] = a;
+	}
+
+	/** Returns whether pixel i is transparent or has the key color. */
+	bool IsKeyed(const std::vector<unsigned char>& rgba, size_t i,
+		const unsigned char* key) {
+		return rgba[i * 4 + 3] < 128 ||
+			(key != NULL && memcmp(&rgba[i * 4], key, 3) == 0);
+	}
+
+	/**
+	 * Checks that index 0 holds exactly the keyed pixels and that every
+	 * opaque pixel got a palette color within max_distance of its own.
+	 * Exact palettes must use their entries without gaps.
+	 */
+	void CheckImage(const std::string& name,
+		const std::vector<unsigned char>& rgba, const unsigned char* key,
+		const std::vector<unsigned char>& palette,
+		const std::vector<unsigned char>& pixels, int max_distance) {
+		bool exact = max_distance == 0;
+		std::set<int> used;
+		bool keyed_ok = true;
+		bool distance_ok = true;
+		for(size_t i = 0; i < pixels.size(); i++) {
+			int index = pixels[i];
+			if(IsKeyed(rgba, i, key) != (index == 0)) {
+				keyed_ok = false;
+			}
+			if(index == 0) {
+				continue;
+			}
+			used.insert(index);
+			for(int c = 0; c < 3; c++) {
+				if(abs(palette[index * 3 + c] - rgba[i * 4 + c]) >
+					max_distance) {
+					distance_ok = false;
+				}
+			}
+		}
+		Check(keyed_ok, name + ": index 0 holds exactly the keyed pixels");
+		Check(distance_ok, name + ": pixels keep their colors");
+
+		if(!exact) {
+			return;
+		}
+
+		// Entries behind the used ones stay black
+		int last = used.empty() ? 0 : *used.rbegin();
+		Check(last == static_cast<int>(used.size()),
+			name + ": palette entries are used without gaps");
+		bool black = true;
+		for(size_t i = (last + 1) * 3; i < palette.size(); i++) {
+			black = black && palette[i] == 0;
+		}
+		Check(black, name + ": unused palette entries are black");
+	}
+}
+
+int main() {
+	Quantizer quantizer;
+	std::vector<unsigned char> palette(768);
+
+	// 200 colors and transparent pixels keep their exact colors
+	std::vector<unsigned char> few(20 * 20 * 4);
+	for(size_t i = 0; i < 400; i++) {
+		SetPixel(few, i, (i % 200) * 7 % 256, i % 200, 255 - i % 200,
+			i % 13 == 0 ? 127 : 128 + i % 128);
+	}
+	std::vector<unsigned char> pixels(400);
+	quantizer.Quantize(few.data(), 20, 20, palette.data(), pixels.data());
+	CheckImage("200 colors", few, NULL, palette, pixels, 0);
+	Check(memcmp(&palette[0], &few[0], 3) == 0,
+		"200 colors: entry 0 is the first transparent color");
+
+	// Exactly 255 opaque colors still fit, a 256th one does not
+	std::vector<unsigned char> full(256 * 4);
+	for(size_t i = 0; i < 256; i++) {
+		SetPixel(full, i, i, 255 - i, i / 2, 255);
+	}
+	pixels.resize(255);
+	quantizer.Quantize(full.data(), 255, 1, palette.data(), pixels.data());
+	CheckImage("255 colors", full, NULL, palette, pixels, 0);
+	std::set<int> used(pixels.begin(), pixels.end());
+	Check(used.size() == 255, "255 colors: one entry per color");
+
+	pixels.resize(256);
+	quantizer.Quantize(full.data(), 256, 1, palette.data(), pixels.data());
+	CheckImage("256 colors", full, NULL, palette, pixels, 16);
+
+	// A smooth gradient with thousands of colors is quantized
+	std::vector<unsigned char> gradient(128 * 128 * 4);
+	for(size_t y = 0; y < 128; y++) {
+		for(size_t x = 0; x < 128; x++) {
+			SetPixel(gradient, y * 128 + x, x * 2, y * 2, (x + y) % 256,
+				x < 4 ? 0 : 255);
+		}
+	}
+	pixels.resize(128 * 128);
+	quantizer.Quantize(gradient.data(), 128, 128, palette.data(),
+		pixels.data());
+	CheckImage("gradient", gradient, NULL, palette, pixels, 48);
+
+	quantizer.SetDithering(true);
+	quantizer.Quantize(gradient.data(), 128, 128, palette.data(),
+		pixels.data());
+	CheckImage("dithered gradient", gradient, NULL, palette, pixels, 255);
+
+	// The key color joins index 0, also when dithering
+	unsigned char key[3] = { 64, 64, 128 };
+	for(size_t i = 0; i < 128 * 128; i += 7) {
+		SetPixel(gradient, i, key[0], key[1], key[2], 255);
+	}
+	quantizer.SetKeyColor(key);
+	quantizer.Quantize(gradient.data(), 128, 128, palette.data(),
+		pixels.data());
+	CheckImage("dithered key color", gradient, key, palette, pixels, 255);
+	Check(memcmp(&palette[0], key, 3) == 0,
+		"key color: entry 0 is the key color");
+
+	quantizer.SetDithering(false);
+	quantizer.Quantize(gradient.data(), 128, 128, palette.data(),
+		pixels.data());
+	CheckImage("key color", gradient, key, palette, pixels, 48);
+
+	if(failures != 0) {
+		std::cerr << failures << " checks failed." << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -13,9 +13,6 @@ function error_out {
 	echo $1
 	exit 1
 }
-function cleanup {
-	rm -rf "$TEMPFOLDER"
-}
 
 # check arguments
 if [ $# -lt 2 -o $# -gt 3 ]; then
@@ -30,28 +27,17 @@ INPUTLC=${INPUT,,}
 [[ $SIZE == +([0-9]) ]] || error_out "Size argument is not a valid number!"
 PIXELCOUNT=$(($SIZE*$SIZE))
 
-# setup a temporary folder to work in
-TEMPFOLDER=$(mktemp -q --tmpdir -d xyz-thumbnailer.XXXX)
-[ -d "$TEMPFOLDER" ] || error_out "Could not create temporary folder!"
-# setup cleanup hook
-trap cleanup EXIT
-
-cp "$INPUT" "$TEMPFOLDER"/image.xyz
-pushd "$TEMPFOLDER" > /dev/null
-
-# convert!
-xyz2png image.xyz
-[ -s image.png ] || error_out "Could not convert xyz file to png!"
-convert image.png -thumbnail ${PIXELCOUNT}@ -gravity center -background transparent -extent ${SIZE}x${SIZE} output.png
-[ -s output.png ] || error_out "Could not convert to thumbnail!"
-
-popd > /dev/null
 OUTPUTFOLDER=$(dirname "$OUTPUT")
 if [ ! -d "$OUTPUTFOLDER" ]; then
 	echo "Output folder does not exist, creating it!"
 	mkdir -p "$OUTPUTFOLDER"
 fi
-cp "$TEMPFOLDER"/output.png "$OUTPUT"
+
+# convert! (piped, no temporary files)
+set -o pipefail
+xyz2png -p fast - < "$INPUT" | convert png:- -thumbnail ${PIXELCOUNT}@ -gravity center -background transparent -extent ${SIZE}x${SIZE} png:"$OUTPUT" \
+	|| error_out "Could not convert xyz file to thumbnail!"
+[ -s "$OUTPUT" ] || error_out "Could not convert to thumbnail!"
 
 # all good
 exit 0
@@ -13,7 +13,7 @@ WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
 
 #include <sstream>
 #include <vector>
-#include <zlib.h>
+#include <xyz.h>
 
 typedef UCHAR uint8_t;
 
@@ -138,29 +138,26 @@ HRESULT RpgMakerXyzThumbnailProvider::GetXyzImage(UINT cx, HBITMAP *phbmp, WTS_A
 		hr = m_pStream->Read(data, (ULONG)size, &bytesRead);
 
 		if (SUCCEEDED(hr)) {
-			if (size < 8 || strncmp((char *) data, "XYZ1", 4) != 0) {
-				return E_INVALIDARG;
+			Xyz::Header header;
+			std::vector<uint8_t> palette_buffer(Xyz::PaletteSize);
+			std::vector<uint8_t> dst_buffer;
+
+			Xyz::Result result = Xyz::ReadHeader((const unsigned char*)data, size, header);
+			if (result == Xyz::Ok) {
+				dst_buffer.resize(Xyz::GetPixelsSize(header));
+				result = Xyz::Decode((const unsigned char*)data, size, header,
+					&palette_buffer.front(), dst_buffer.data(), dst_buffer.size());
 			}
-	
-			unsigned short w;
-			memcpy(&w, &data[4], 2);
-			unsigned short h;
-			memcpy(&h, &data[6], 2);
-
-			uLongf src_size = (uLongf)(size - 8);
-			Bytef* src_buffer = (Bytef*)&data[8];
-			uLongf dst_size = 768 + (w * h);
-			std::vector<Bytef> dst_buffer(dst_size);
-
-			int status = uncompress(&dst_buffer.front(), &dst_size, src_buffer, src_size);
 
 			free(data);
 
-			if (status != Z_OK) {
+			if (result != Xyz::Ok) {
 				return E_INVALIDARG;
 			}
-			const uint8_t (*palette)[3] = (const uint8_t(*)[3]) &dst_buffer.front();
+			const uint8_t (*palette)[3] = (const uint8_t(*)[3]) &palette_buffer.front();
 
+			unsigned short w = header.width;
+			unsigned short h = header.height;
 			int width = w;
 			int height = h;
 			void* pixels = malloc(w * h * 4);
@@ -170,7 +167,7 @@ HRESULT RpgMakerXyzThumbnailProvider::GetXyzImage(UINT cx, HBITMAP *phbmp, WTS_A
 			}
 
 			uint8_t* dst = (uint8_t*) pixels;
-			const uint8_t* src = (const uint8_t*) &dst_buffer[768];
+			const uint8_t* src = (const uint8_t*) dst_buffer.data();
 			for (int y = 0; y < h; y++) {
 				for (int x = 0; x < w; x++) {
 					uint8_t pix = *src++;
@@ -0,0 +1,231 @@
+/*
+ * This file is part of xyz2png. Copyright (c) 2015 xyz2png authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "image_writer.h"
+#include <cstring>
+
+void StoreLittleEndian(unsigned char* out, unsigned long value, int bytes) {
+	for(int i = 0; i < bytes; i++) {
+		out[i] = (value >> (i * 8)) & 0xFF;
+	}
+}
+
+void StoreBigEndian(unsigned char* out, unsigned long value, int bytes) {
+	for(int i = 0; i < bytes; i++) {
+		out[i] = (value >> ((bytes - 1 - i) * 8)) & 0xFF;
+	}
+}
+
+const unsigned char* GetRow(const Xyz::Header& header, unsigned char* pixels,
+	Xyz::Decoder* decoder, int y, Xyz::Result& result) {
+	if(decoder == NULL) {
+		return &pixels[(size_t) header.width * y];
+	}
+
+	result = decoder->ReadRow(pixels);
+	return result == Xyz::Ok ? pixels : NULL;
+}
+
+bool FinishImage(Xyz::Decoder* decoder, Xyz::Result result, bool written,
+	const std::string& filename, const std::string& out_filename,
+	std::ostream& err) {
+	if(decoder != NULL && result == Xyz::Ok && written) {
+		result = decoder->Finish();
+	}
+
+	if(result != Xyz::Ok) {
+		err << "Error uncompressing XYZ file "
+			<< filename << ": "
+			<< Xyz::GetResultString(result) << "." << std::endl;
+		return false;
+	}
+	if(!written) {
+		err << "Error writing file "
+			<< out_filename << "." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool WriteBmp(const Xyz::Header& header, const unsigned char* xyz_palette,
+	unsigned char* pixels, Xyz::Decoder* decoder, FILE* file,
+	const std::string& filename, const std::string& out_filename,
+	std::ostream& err) {
+	const size_t offset = 14 + 40 + 256 * 4;
+	const unsigned char padding[3] = { 0, 0, 0 };
+	unsigned char bmp_header[offset];
+	size_t stride = ((size_t) header.width + 3) & ~(size_t) 3;
+	long height = decoder != NULL ? -(long) header.height : header.height;
+
+	// File header and BITMAPINFOHEADER
+	memset(bmp_header, 0, offset);
+	bmp_header[0] = 'B';
+	bmp_header[1] = 'M';
+	StoreLittleEndian(&bmp_header[2], offset + stride * header.height, 4);
+	StoreLittleEndian(&bmp_header[10], offset, 4);
+	StoreLittleEndian(&bmp_header[14], 40, 4);
+	StoreLittleEndian(&bmp_header[18], header.width, 4);
+	StoreLittleEndian(&bmp_header[22], (unsigned long) height, 4);
+	StoreLittleEndian(&bmp_header[26], 1, 2);
+	StoreLittleEndian(&bmp_header[28], 8, 2);
+	StoreLittleEndian(&bmp_header[34], stride * header.height, 4);
+	StoreLittleEndian(&bmp_header[38], 2835, 4);
+	StoreLittleEndian(&bmp_header[42], 2835, 4);
+	StoreLittleEndian(&bmp_header[46], 256, 4);
+
+	// Palette in BGR0 order
+	for(int i = 0; i < 256; i++) {
+		bmp_header[54 + i * 4] = xyz_palette[i * 3 + 2];
+		bmp_header[54 + i * 4 + 1] = xyz_palette[i * 3 + 1];
+		bmp_header[54 + i * 4 + 2] = xyz_palette[i * 3];
+	}
+
+	Xyz::Result result = Xyz::Ok;
+	bool written = fwrite(bmp_header, 1, offset, file) == offset;
+	for(int i = 0; i < header.height && written; i++) {
+		int y = decoder != NULL ? i : header.height - 1 - i;
+		const unsigned char* row = GetRow(header, pixels, decoder, y, result);
+		if(row == NULL) {
+			break;
+		}
+		written = fwrite(row, 1, header.width, file) == header.width
+			&& fwrite(padding, 1, stride - header.width, file)
+				== stride - header.width;
+	}
+
+	return FinishImage(decoder, result, written, filename, out_filename, err);
+}
+
+bool WritePpm(const Xyz::Header& header, const unsigned char* xyz_palette,
+	unsigned char* pixels, Xyz::Decoder* decoder, FILE* file,
+	std::vector<unsigned char>& row, const std::string& filename,
+	const std::string& out_filename, std::ostream& err) {
+	Xyz::Result result = Xyz::Ok;
+	bool written = fprintf(file, "P6\n%d %d\n255\n", header.width,
+		header.height) > 0;
+
+	row.resize((size_t) header.width * 3);
+	for(int y = 0; y < header.height && written; y++) {
+		const unsigned char* indices = GetRow(header, pixels, decoder, y,
+			result);
+		if(indices == NULL) {
+			break;
+		}
+		for(size_t x = 0; x < header.width; x++) {
+			memcpy(&row[x * 3], &xyz_palette[indices[x] * 3], 3);
+		}
+		written = fwrite(row.data(), 1, row.size(), file) == row.size();
+	}
+
+	return FinishImage(decoder, result, written, filename, out_filename, err);
+}
+
+bool WriteQoi(const Xyz::Header& header, const unsigned char* xyz_palette,
+	unsigned char* pixels, Xyz::Decoder* decoder, FILE* file,
+	std::vector<unsigned char>& row, const std::string& filename,
+	const std::string& out_filename, std::ostream& err) {
+	const unsigned char end_marker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	unsigned char qoi_header[14];
+	memcpy(qoi_header, "qoif", 4);
+	StoreBigEndian(&qoi_header[4], header.width, 4);
+	StoreBigEndian(&qoi_header[8], header.height, 4);
+	qoi_header[12] = 3;
+	qoi_header[13] = 0;
+
+	// All pixels are opaque, alpha never changes from its start value
+	unsigned char previous[3] = { 0, 0, 0 };
+	unsigned char seen[64][3];
+	bool seen_valid[64];
+	memset(seen_valid, 0, sizeof(seen_valid));
+	int run = 0;
+	size_t remaining = (size_t) header.width * header.height;
+
+	Xyz::Result result = Xyz::Ok;
+	bool written = fwrite(qoi_header, 1, sizeof(qoi_header), file)
+		== sizeof(qoi_header);
+
+	// Every pixel takes at most 4 bytes, plus a pending run
+	row.resize((size_t) header.width * 4 + 1);
+	for(int y = 0; y < header.height && written; y++) {
+		const unsigned char* indices = GetRow(header, pixels, decoder, y,
+			result);
+		if(indices == NULL) {
+			break;
+		}
+
+		unsigned char* out = row.data();
+		for(size_t x = 0; x < header.width; x++) {
+			const unsigned char* pixel = &xyz_palette[indices[x] * 3];
+			remaining--;
+
+			if(memcmp(pixel, previous, 3) == 0) {
+				run++;
+				if(run == 62 || remaining == 0) {
+					*out++ = 0xC0 | (run - 1);
+					run = 0;
+				}
+				continue;
+			}
+
+			if(run > 0) {
+				*out++ = 0xC0 | (run - 1);
+				run = 0;
+			}
+
+			int hash = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7
+				+ 255 * 11) % 64;
+			if(seen_valid[hash] && memcmp(seen[hash], pixel, 3) == 0) {
+				*out++ = hash;
+			} else {
+				seen_valid[hash] = true;
+				memcpy(seen[hash], pixel, 3);
+
+				signed char dr = pixel[0] - previous[0];
+				signed char dg = pixel[1] - previous[1];
+				signed char db = pixel[2] - previous[2];
+				int dr_dg = dr - dg;
+				int db_dg = db - dg;
+
+				if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1
+					&& db >= -2 && db <= 1) {
+					*out++ = 0x40 | ((dr + 2) << 4) | ((dg + 2) << 2)
+						| (db + 2);
+				} else if(dg >= -32 && dg <= 31 && dr_dg >= -8
+					&& dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+					*out++ = 0x80 | (dg + 32);
+					*out++ = ((dr_dg + 8) << 4) | (db_dg + 8);
+				} else {
+					*out++ = 0xFE;
+					*out++ = pixel[0];
+					*out++ = pixel[1];
+					*out++ = pixel[2];
+				}
+			}
+			memcpy(previous, pixel, 3);
+		}
+
+		size_t size = out - row.data();
+		written = fwrite(row.data(), 1, size, file) == size;
+	}
+
+	if(written) {
+		written = fwrite(end_marker, 1, sizeof(end_marker), file)
+			== sizeof(end_marker);
+	}
+
+	return FinishImage(decoder, result, written, filename, out_filename, err);
+}
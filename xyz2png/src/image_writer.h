@@ -0,0 +1,70 @@
+/*
+ * This file is part of xyz2png. Copyright (c) 2015 xyz2png authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef XYZ2PNG_IMAGE_WRITER_H
+#define XYZ2PNG_IMAGE_WRITER_H
+
+#include <xyz.h>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Writes an image as 8 bit palette BMP. The rows are stored bottom up,
+ * or top down when they are inflated one by one by a decoder.
+ */
+bool WriteBmp(const Xyz::Header& header, const unsigned char* xyz_palette,
+	unsigned char* pixels, Xyz::Decoder* decoder, FILE* file,
+	const std::string& filename, const std::string& out_filename,
+	std::ostream& err);
+
+/** Writes an image as binary RGB PPM, which has no palette. */
+bool WritePpm(const Xyz::Header& header, const unsigned char* xyz_palette,
+	unsigned char* pixels, Xyz::Decoder* decoder, FILE* file,
+	std::vector<unsigned char>& row, const std::string& filename,
+	const std::string& out_filename, std::ostream& err);
+
+/** Writes an image as RGB QOI, see https://qoiformat.org/. */
+bool WriteQoi(const Xyz::Header& header, const unsigned char* xyz_palette,
+	unsigned char* pixels, Xyz::Decoder* decoder, FILE* file,
+	std::vector<unsigned char>& row, const std::string& filename,
+	const std::string& out_filename, std::ostream& err);
+
+/**
+ * Returns row y of an image for the BMP, PPM and QOI writers. With a
+ * decoder the next row is inflated into pixels instead, NULL is returned
+ * on errors and result receives the error.
+ */
+const unsigned char* GetRow(const Xyz::Header& header, unsigned char* pixels,
+	Xyz::Decoder* decoder, int y, Xyz::Result& result);
+
+/**
+ * Ends an image of the BMP, PPM and QOI writers, checks the end of the
+ * stream when decoding row by row and reports errors to err.
+ */
+bool FinishImage(Xyz::Decoder* decoder, Xyz::Result result, bool written,
+	const std::string& filename, const std::string& out_filename,
+	std::ostream& err);
+
+/** Stores a value in little endian byte order. */
+void StoreLittleEndian(unsigned char* out, unsigned long value, int bytes);
+
+/** Stores a value in big endian byte order. */
+void StoreBigEndian(unsigned char* out, unsigned long value, int bytes);
+
+#endif
@@ -17,9 +17,18 @@
 
 #include <zlib.h>
 #include <png.h>
+#include <xyz.h>
+#include <xyz_dir.h>
+#include <xyz_file.h>
+#include <xyz_manifest.h>
+#include <xyz_pool.h>
+#include "image_writer.h"
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
-#include <fstream>
+#include <map>
+#include <mutex>
 #include <vector>
 #include <sstream>
 #ifdef _WIN32
@@ -36,6 +45,198 @@ std::string GetFilename(const std::string& str);
 /** Returns that path (everything left to the last /) */
 std::string GetPath(const std::string& str);
 
+/** Trade-off between PNG encoding speed and file size. */
+enum Profile {
+	/** Low zlib level, no filtering. */
+	ProfileFast,
+	/** Medium zlib level, no filtering. */
+	ProfileBalanced,
+	/** Maximum zlib level and memory, no filtering. */
+	ProfileMax,
+	/** Tries several filter and strategy combinations per image. */
+	ProfileSmallest
+};
+
+/** Command line names of the profiles, indexed by Profile. */
+const char* const profile_names[] = {
+	"fast", "balanced", "max", "smallest"
+};
+
+/** Output file types, the PNG profiles only apply to TypePng. */
+enum OutputType {
+	TypePng,
+	/** 8 bit palette BMP, uncompressed. */
+	TypeBmp,
+	/** Binary RGB PPM (P6), uncompressed. */
+	TypePpm,
+	/** RGB QOI, fast to encode and decode. */
+	TypeQoi
+};
+
+/** Command line names and file extensions of the types. */
+const char* const type_names[] = {
+	"png", "bmp", "ppm", "qoi"
+};
+
+/** Report formats of the probe mode. */
+enum ProbeFormat {
+	ProbeNone,
+	ProbeJson,
+	ProbeCsv
+};
+
+/** Palette searches. */
+enum SearchMode {
+	SearchNone,
+	/** Any palette entry has the color. */
+	SearchPalette,
+	/** The color key (palette entry 0) has the color. */
+	SearchKey
+};
+
+/** Conversion settings from the command line. */
+struct Options {
+	/** Number of files converted in parallel. */
+	unsigned jobs;
+	/** Decode row by row instead of the whole image at once. */
+	bool stream;
+	/** Output file type. */
+	OutputType type;
+	/** PNG compression effort. */
+	Profile profile;
+	/** Skips files converted before, NULL to convert all files. */
+	Xyz::Manifest* manifest;
+	/** Only check the files instead of converting them. */
+	bool verify;
+	/** Only report the image properties instead of converting. */
+	ProbeFormat probe;
+	/** Include the palette in the probe report. */
+	bool probe_palette;
+	/** Only search the palettes for a color instead of converting. */
+	SearchMode search;
+	/** RGB color to search for. */
+	unsigned char search_color[3];
+};
+
+/** Compression settings of a single PNG encoding attempt. */
+struct PngSettings {
+	int level;
+	int mem_level;
+	int strategy;
+	int filters;
+};
+
+/** Destination of a PNG encoding attempt, a file or a memory buffer. */
+struct PngOutput {
+	FILE* file;
+	std::vector<unsigned char>* buffer;
+};
+
+/** Settings of the single attempt profiles, indexed by Profile. */
+const PngSettings profile_settings[] = {
+	{ 1, 8, Z_DEFAULT_STRATEGY, PNG_FILTER_NONE },
+	{ 6, 8, Z_DEFAULT_STRATEGY, PNG_FILTER_NONE },
+	{ Z_BEST_COMPRESSION, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, PNG_FILTER_NONE }
+};
+
+/**
+ * Candidates of ProfileSmallest. Palette images rarely profit from
+ * filtering, but dithered images and gradients sometimes do.
+ */
+const PngSettings smallest_settings[] = {
+	{ Z_BEST_COMPRESSION, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, PNG_FILTER_NONE },
+	{ Z_BEST_COMPRESSION, MAX_MEM_LEVEL, Z_RLE, PNG_FILTER_NONE },
+	{ Z_BEST_COMPRESSION, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, PNG_FILTER_SUB },
+	{ Z_BEST_COMPRESSION, MAX_MEM_LEVEL, Z_FILTERED, PNG_FILTER_SUB },
+	{ Z_BEST_COMPRESSION, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, PNG_FILTER_UP },
+	{ Z_BEST_COMPRESSION, MAX_MEM_LEVEL, Z_FILTERED, PNG_FILTER_UP },
+	{ Z_BEST_COMPRESSION, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, PNG_FILTER_AVG },
+	{ Z_BEST_COMPRESSION, MAX_MEM_LEVEL, Z_FILTERED, PNG_FILTER_AVG },
+	{ Z_BEST_COMPRESSION, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, PNG_FILTER_PAETH },
+	{ Z_BEST_COMPRESSION, MAX_MEM_LEVEL, Z_FILTERED, PNG_FILTER_PAETH },
+	{ Z_BEST_COMPRESSION, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY, PNG_ALL_FILTERS },
+	{ Z_BEST_COMPRESSION, MAX_MEM_LEVEL, Z_FILTERED, PNG_ALL_FILTERS }
+};
+
+/**
+ * State a worker thread keeps across files. The buffers only grow, so a
+ * batch run stops allocating per file after the largest image.
+ */
+struct WorkerContext {
+	/** Input file, closed after every file but keeps its read buffer. */
+	Xyz::InputFile input;
+	/** Incremental decoder, its zlib state is reset for every file. */
+	Xyz::Decoder decoder;
+	/** Palette directly followed by the pixels, or by one row. */
+	std::vector<unsigned char> image;
+	/** Smallest PNG of ProfileSmallest so far. */
+	std::vector<unsigned char> best;
+	/** Current PNG attempt of ProfileSmallest. */
+	std::vector<unsigned char> candidate;
+	/** Encoded row of the PPM and QOI writers. */
+	std::vector<unsigned char> row;
+};
+
+/** Converts a XYZ file into a PNG file, errors are written to err. */
+bool ConvertFile(const std::string& filename,
+	const std::string& png_filename, const Options& options,
+	WorkerContext& context, std::ostream& err);
+
+/**
+ * Checks a XYZ file without converting it and writes a tab separated
+ * report line to report: result, width, height, inflated size, trailing
+ * size and filename. Returns whether the file is valid.
+ */
+bool VerifyFile(const std::string& filename, std::ostream& report);
+
+/**
+ * Reads the header of a XYZ file, and the palette when requested, and
+ * writes a report record in the probe format to report, without
+ * separators. Returns whether the file is a valid XYZ file.
+ */
+bool ProbeFile(const std::string& filename, const Options& options,
+	std::ostream& report);
+
+/**
+ * Inflates only the palette of a XYZ file and writes the filename and the
+ * matching palette indices to report when it contains the search color.
+ * Returns whether the palette could be read, errors are written to err.
+ */
+bool SearchFile(const std::string& filename, const Options& options,
+	std::ostream& report, std::ostream& err);
+
+/** Parses a RGB color given as rrggbb or #rrggbb. */
+bool ParseColor(const std::string& str, unsigned char* color);
+
+/** Writes a string as quoted JSON string. */
+void WriteJsonString(std::ostream& out, const std::string& str);
+
+/** Writes a string as quoted CSV field. */
+void WriteCsvString(std::ostream& out, const std::string& str);
+
+/** Returns the output path of a file in an output directory. */
+std::string GetOutputFilename(const std::string& output_dir,
+	const std::string& name);
+
+/** Opens an input file, "-" reads standard input. */
+bool OpenInputFile(Xyz::InputFile& file, const std::string& filename);
+
+/**
+ * Encodes an image as PNG. With a decoder, pixels holds a single row and
+ * the rows are inflated one by one, otherwise pixels holds the whole image.
+ * Errors are written to err.
+ */
+bool WritePng(const PngSettings& settings, const Xyz::Header& header,
+	const unsigned char* xyz_palette, unsigned char* pixels,
+	Xyz::Decoder* decoder, PngOutput& output, const std::string& filename,
+	const std::string& png_filename, std::ostream& err);
+
+/** libpng write callback appending to a PngOutput buffer. */
+void AppendPngData(png_structp png_ptr, png_bytep data, png_size_t length);
+
+/** libpng flush callback, memory buffers need no flushing. */
+void FlushPngData(png_structp png_ptr);
+
 std::string GetFilename(const std::string& str) {
 	std::string s = str;
 #ifdef _WIN32
@@ -76,167 +277,768 @@ std::string GetPath(const std::string& str) {
 	return s;
 }
 
-int main(int argc, char* argv[]) {
-	if(argc < 2)
+void AppendPngData(png_structp png_ptr, png_bytep data, png_size_t length) {
+	std::vector<unsigned char>* buffer =
+		(std::vector<unsigned char>*) png_get_io_ptr(png_ptr);
+	buffer->insert(buffer->end(), data, data + length);
+}
+
+void FlushPngData(png_structp) {
+}
+
+bool WritePng(const PngSettings& settings, const Xyz::Header& header,
+	const unsigned char* xyz_palette, unsigned char* pixels,
+	Xyz::Decoder* decoder, PngOutput& output, const std::string& filename,
+	const std::string& png_filename, std::ostream& err) {
+	png_structp png_ptr;
+	png_infop info_ptr;
+	png_color palette[PNG_MAX_PALETTE_LENGTH];
+	// volatile: modified between setjmp and a possible longjmp
+	volatile Xyz::Result result = Xyz::Ok;
+
+	// Create PNG write structure
+	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,
+		NULL, NULL);
+	if(png_ptr == NULL)
 	{
-		std::cout << "Usage: " << argv[0]
-			<< " filename" << std::endl;
-		return 1;
+		err << "Error creating PNG write structure for "
+			<< png_filename << "." << std::endl;
+		return false;
 	}
 
-	for(int arg = 1; arg < argc; arg++) {
-		std::ifstream file(argv[arg],
-			std::ios::binary | std::ios::ate);
-		if(!file) {
-			std::cerr << "Error reading file "
-				<< argv[arg] << "." << std::endl;
-			return 1;
+	// Create PNG info structure
+	info_ptr = png_create_info_struct(png_ptr);
+	if(info_ptr == NULL)
+	{
+		err << "Error creating PNG info structure for "
+			<< png_filename << "." << std::endl;
+		png_destroy_write_struct(&png_ptr, NULL);
+		return false;
+	}
+
+	// Init I/O functions
+	if(setjmp(png_jmpbuf(png_ptr)))
+	{
+		err << "Error initializing PNG I/O for "
+			<< png_filename << "." << std::endl;
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		return false;
+	}
+	if(output.file != NULL) {
+		png_init_io(png_ptr, output.file);
+	} else {
+		png_set_write_fn(png_ptr, output.buffer, AppendPngData,
+			FlushPngData);
+	}
+
+	// Set compression parameters
+	png_set_compression_level(png_ptr, settings.level);
+	png_set_compression_mem_level(png_ptr, settings.mem_level);
+	png_set_compression_strategy(png_ptr, settings.strategy);
+	png_set_compression_buffer_size(png_ptr, 1024 * 1024);
+	png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, settings.filters);
+
+	// Write header
+	if(setjmp(png_jmpbuf(png_ptr))) {
+		err << "Error writing PNG header for "
+			<< png_filename << "." << std::endl;
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		return false;
+	}
+	png_set_IHDR(png_ptr, info_ptr, header.width, header.height, 8,
+		PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE,
+		PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+
+	// Write palette
+	if(setjmp(png_jmpbuf(png_ptr))) {
+		err << "Error writing PNG palette for "
+			<< png_filename << "." << std::endl;
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		return false;
+	}
+	for(int i = 0; i < PNG_MAX_PALETTE_LENGTH; i++)
+	{
+		palette[i].red = xyz_palette[i * 3];
+		palette[i].green = xyz_palette[i * 3 + 1];
+		palette[i].blue = xyz_palette[i * 3 + 2];
+	}
+	png_set_PLTE(png_ptr, info_ptr, palette,
+		PNG_MAX_PALETTE_LENGTH);
+
+	png_write_info(png_ptr, info_ptr);
+
+	// Write image
+	if(setjmp(png_jmpbuf(png_ptr))) {
+		err << "Error writing PNG image for "
+			<< png_filename << "." << std::endl;
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		return false;
+	}
+	for(int i = 0; i < header.height; i++) {
+		if(decoder != NULL) {
+			// A corrupt row is not written
+			result = decoder->ReadRow(pixels);
+			if(result != Xyz::Ok) {
+				break;
+			}
+			png_write_row(png_ptr, pixels);
+		} else {
+			png_write_row(png_ptr, &pixels[(size_t) header.width * i]);
 		}
+	}
+	if(decoder != NULL && result == Xyz::Ok) {
+		result = decoder->Finish();
+	}
 
-		long size = file.tellg();
-		char* header = new char[4];
+	if(result != Xyz::Ok) {
+		err << "Error uncompressing XYZ file "
+			<< filename << ": "
+			<< Xyz::GetResultString(result) << "." << std::endl;
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		return false;
+	}
 
-		file.seekg(0, std::ios::beg);
-		file.read((char*) header, 4);
-		if(memcmp(header, "XYZ1", 4) != 0) {
-			std::cerr << "Input file " << argv[arg]
-				<< " is not a XYZ file: '"
-				<< header << "'." << std::endl;
-			delete[] header;
-			return 1;
+	png_write_end(png_ptr, info_ptr);
+
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+
+	return true;
+}
+
+std::string GetOutputFilename(const std::string& output_dir,
+	const std::string& name) {
+	if(output_dir.empty()) {
+		return name;
+	}
+	return output_dir + "/" + name;
+}
+
+bool OpenInputFile(Xyz::InputFile& file, const std::string& filename) {
+	if(filename == "-") {
+		return file.OpenStdin();
+	}
+	return file.Open(filename);
+}
+
+bool VerifyFile(const std::string& filename, std::ostream& report) {
+	Xyz::InputFile xyz_file;
+	Xyz::VerifyInfo info;
+	const char* result_name = "read";
+	bool success = false;
+
+	if(OpenInputFile(xyz_file, filename)) {
+		Xyz::Result result = Xyz::Verify(xyz_file.GetData(),
+			xyz_file.GetSize(), info);
+		result_name = Xyz::GetResultName(result);
+		success = result == Xyz::Ok;
+	} else {
+		info.header.width = 0;
+		info.header.height = 0;
+		info.inflated_size = 0;
+		info.trailing_size = 0;
+	}
+
+	report << result_name << "\t" << info.header.width
+		<< "\t" << info.header.height << "\t" << info.inflated_size
+		<< "\t" << info.trailing_size << "\t" << filename << "\n";
+	return success;
+}
+
+bool SearchFile(const std::string& filename, const Options& options,
+	std::ostream& report, std::ostream& err) {
+	Xyz::InputFile xyz_file;
+	if(!OpenInputFile(xyz_file, filename)) {
+		err << "Error reading file "
+			<< filename << "." << std::endl;
+		return false;
+	}
+
+	Xyz::Header header;
+	unsigned char palette[Xyz::PaletteSize];
+	Xyz::Result result = Xyz::ReadPalette(xyz_file.GetData(),
+		xyz_file.GetSize(), header, palette);
+	if(result != Xyz::Ok) {
+		err << "Error reading palette of "
+			<< filename << ": "
+			<< Xyz::GetResultString(result) << "." << std::endl;
+		return false;
+	}
+
+	size_t entries = options.search == SearchKey ? 1 : 256;
+	bool found = false;
+	for(size_t i = 0; i < entries; i++) {
+		if(memcmp(&palette[i * 3], options.search_color, 3) == 0) {
+			if(found) {
+				report << ",";
+			} else {
+				report << filename << "\t";
+			}
+			report << i;
+			found = true;
 		}
-		delete[] header;
+	}
+	if(found) {
+		report << "\n";
+	}
 
-		unsigned short width;
-		unsigned short height;
-		file.read((char*) &width, 2);
-		file.read((char*) &height, 2);
+	return true;
+}
 
-		int compressed_xyz_size = size - 8;
-		Bytef* compressed_xyz_data = new Bytef[compressed_xyz_size];
+bool ParseColor(const std::string& str, unsigned char* color) {
+	std::string hex = str.compare(0, 1, "#") == 0 ? str.substr(1) : str;
+	if(hex.size() != 6
+		|| hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+		return false;
+	}
 
-		file.read((char*) compressed_xyz_data, compressed_xyz_size);
+	for(int i = 0; i < 3; i++) {
+		color[i] = (unsigned char) strtoul(hex.substr(i * 2, 2).c_str(),
+			NULL, 16);
+	}
+	return true;
+}
 
-		uLongf xyz_size = 768 + (width * height);
-		std::vector<Bytef> xyz_data(
-			xyz_size);
+void WriteJsonString(std::ostream& out, const std::string& str) {
+	const char* hex = "0123456789abcdef";
 
-		int status = uncompress(&xyz_data.front(),
-			&xyz_size, compressed_xyz_data,
-			compressed_xyz_size);
+	out << '"';
+	for(size_t i = 0; i < str.size(); i++) {
+		unsigned char c = str[i];
+		if(c == '"' || c == '\\') {
+			out << '\\' << c;
+		} else if(c < 0x20) {
+			out << "\\u00" << hex[c >> 4] << hex[c & 0xF];
+		} else {
+			out << c;
+		}
+	}
+	out << '"';
+}
 
-		if(status != Z_OK) {
-			std::cerr << "Error uncompressing XYZ file "
-				<< argv[arg] << "." << std::endl;
-			return 1;
+void WriteCsvString(std::ostream& out, const std::string& str) {
+	out << '"';
+	for(size_t i = 0; i < str.size(); i++) {
+		if(str[i] == '"') {
+			out << '"';
 		}
+		out << str[i];
+	}
+	out << '"';
+}
 
-		FILE *png_file;
-		png_structp png_ptr;
-		png_infop info_ptr;
-		std::string png_filename;
-		std::stringstream ss;
+bool ProbeFile(const std::string& filename, const Options& options,
+	std::ostream& report) {
+	// Only the touched pages of the mapping are read from disk
+	Xyz::InputFile xyz_file;
+	Xyz::Header header;
+	Xyz::Result result = Xyz::ErrorTruncated;
+	size_t compressed_size = 0;
+	const char* result_name = "read";
+	std::vector<unsigned char> palette;
 
-		ss << GetFilename(argv[arg]) << ".png";
-		png_filename = ss.str();
+	header.width = 0;
+	header.height = 0;
+	if(OpenInputFile(xyz_file, filename)) {
+		result = Xyz::ReadHeader(xyz_file.GetData(), xyz_file.GetSize(),
+			header);
+		if(result == Xyz::Ok) {
+			compressed_size = xyz_file.GetSize() - Xyz::HeaderSize;
+		}
 
-		// Open file for writing
-		png_file = fopen(png_filename.c_str(), "wb");
-		if(png_file == NULL) {
-			std::cerr << "Error creating file "
-				<< png_filename<< "." << std::endl;
-			return 1;
+		// The palette is at the start of the zlib stream
+		if(result == Xyz::Ok && options.probe_palette) {
+			palette.resize(Xyz::PaletteSize);
+			result = Xyz::ReadPalette(xyz_file.GetData(), xyz_file.GetSize(),
+				header, palette.data());
+			if(result != Xyz::Ok) {
+				palette.clear();
+			}
 		}
+		result_name = Xyz::GetResultName(result);
+	}
 
-		// Create PNG write structure
-		png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,
-			NULL, NULL);
-		if(png_ptr == NULL)
-		{
-			std::cerr << "Error creating PNG write structure for "
-				<< png_filename << "." << std::endl;
-			fclose(png_file);
-			return 1;
+	const char* hex = "0123456789abcdef";
+	if(options.probe == ProbeJson) {
+		report << "  {\"filename\": ";
+		WriteJsonString(report, filename);
+		report << ", \"result\": \"" << result_name << "\""
+			<< ", \"width\": " << header.width
+			<< ", \"height\": " << header.height
+			<< ", \"compressed_size\": " << compressed_size;
+		if(options.probe_palette) {
+			report << ", \"palette\": [";
+			for(size_t i = 0; i < palette.size(); i++) {
+				report << (i == 0 ? "\"#" : (i % 3 == 0 ? "\", \"#" : ""))
+					<< hex[palette[i] >> 4] << hex[palette[i] & 0xF];
+			}
+			report << (palette.empty() ? "]" : "\"]");
+		}
+		report << "}";
+	} else {
+		WriteCsvString(report, filename);
+		report << "," << result_name << "," << header.width
+			<< "," << header.height << "," << compressed_size;
+		if(options.probe_palette) {
+			report << ",";
+			for(size_t i = 0; i < palette.size(); i++) {
+				report << (i > 0 && i % 3 == 0 ? " " : "")
+					<< hex[palette[i] >> 4] << hex[palette[i] & 0xF];
+			}
 		}
+		report << "\n";
+	}
 
-		// Create PNG info structure
-		info_ptr = png_create_info_struct(png_ptr);
-		if(info_ptr == NULL)
-		{
-			std::cerr << "Error creating PNG info structure for "
-				<< png_filename << "." << std::endl;
-			fclose(png_file);
-			png_destroy_write_struct(&png_ptr, NULL);
-			return 1;
+	return result == Xyz::Ok;
+}
+
+bool ConvertFile(const std::string& filename,
+	const std::string& png_filename, const Options& options,
+	WorkerContext& context, std::ostream& err) {
+	std::string settings = type_names[options.type];
+	if(options.type == TypePng) {
+		settings = settings + " " + profile_names[options.profile];
+	}
+	bool smallest = options.type == TypePng
+		&& options.profile == ProfileSmallest;
+	bool to_stdout = png_filename == "-";
+	Xyz::Manifest* manifest = filename == "-" || to_stdout ? NULL :
+		options.manifest;
+
+	if(manifest != NULL &&
+		manifest->IsUpToDate(filename, png_filename, settings)) {
+		return true;
+	}
+
+	Xyz::InputFile& xyz_file = context.input;
+	if(!OpenInputFile(xyz_file, filename)) {
+		err << "Error reading file "
+			<< filename << "." << std::endl;
+		return false;
+	}
+
+	const unsigned char* data = xyz_file.GetData();
+	size_t size = xyz_file.GetSize();
+
+	// The manifest records the contents that were converted
+	unsigned long long hash = manifest != NULL ?
+		Xyz::Hash(data, size) : 0;
+
+	// Streaming only keeps a single row of indices in memory, the
+	// smallest profile needs the whole image for its attempts
+	bool stream = options.stream && !smallest;
+	Xyz::Header header;
+	Xyz::Decoder& decoder = context.decoder;
+	Xyz::Result result;
+
+	if(stream) {
+		result = decoder.Begin(data, size);
+		header = decoder.GetHeader();
+	} else {
+		result = Xyz::ReadHeader(data, size, header);
+	}
+	if(result != Xyz::Ok) {
+		err << "Input file " << filename
+			<< " is not a XYZ file: "
+			<< Xyz::GetResultString(result) << "." << std::endl;
+		return false;
+	}
+
+	// Pixels directly behind the palette save a copy in most backends
+	size_t pixels_size = stream ? header.width : Xyz::GetPixelsSize(header);
+	context.image.resize(Xyz::PaletteSize + pixels_size);
+	unsigned char* xyz_palette = context.image.data();
+	unsigned char* xyz_pixels = xyz_palette + Xyz::PaletteSize;
+
+	if(stream) {
+		result = decoder.ReadPalette(xyz_palette);
+	} else {
+		result = Xyz::Decode(data, size, header,
+			xyz_palette, xyz_pixels, pixels_size);
+	}
+
+	if(result != Xyz::Ok) {
+		err << "Error uncompressing XYZ file "
+			<< filename << ": "
+			<< Xyz::GetResultString(result) << "." << std::endl;
+		return false;
+	}
+
+	// Encode all candidates in memory and keep the smallest one
+	std::vector<unsigned char>& best = context.best;
+	std::vector<unsigned char>& candidate = context.candidate;
+	if(smallest) {
+		PngOutput output = { NULL, &candidate };
+
+		best.clear();
+		for(size_t i = 0; i < sizeof(smallest_settings)
+			/ sizeof(smallest_settings[0]); i++) {
+			candidate.clear();
+			if(!WritePng(smallest_settings[i], header, xyz_palette,
+				xyz_pixels, NULL, output, filename, png_filename,
+				err)) {
+				return false;
+			}
+			if(best.empty() || candidate.size() < best.size()) {
+				best.swap(candidate);
+			}
 		}
+	}
+
+	if(!to_stdout && !Xyz::CreateDirectories(GetPath(png_filename))) {
+		err << "Error creating directory "
+			<< GetPath(png_filename) << "." << std::endl;
+		return false;
+	}
+
+	// Open file for writing
+	FILE* png_file;
+	if(to_stdout) {
+		png_file = stdout;
+		Xyz::SetBinaryMode(stdout);
+	} else {
+		png_file = fopen(png_filename.c_str(), "wb");
+	}
+	if(png_file == NULL) {
+		err << "Error creating file "
+			<< png_filename<< "." << std::endl;
+		return false;
+	}
 
-		// Init I/O functions
-		if(setjmp(png_jmpbuf(png_ptr)))
-		{
-			std::cerr << "Error initializing PNG I/O for "
+	bool success;
+	Xyz::Decoder* row_decoder = stream ? &decoder : NULL;
+	if(options.type == TypeBmp) {
+		success = WriteBmp(header, xyz_palette, xyz_pixels, row_decoder,
+			png_file, filename, png_filename, err);
+	} else if(options.type == TypePpm) {
+		success = WritePpm(header, xyz_palette, xyz_pixels, row_decoder,
+			png_file, context.row, filename, png_filename, err);
+	} else if(options.type == TypeQoi) {
+		success = WriteQoi(header, xyz_palette, xyz_pixels, row_decoder,
+			png_file, context.row, filename, png_filename, err);
+	} else if(smallest) {
+		success = fwrite(best.data(), 1, best.size(), png_file)
+			== best.size();
+		if(!success) {
+			err << "Error writing file "
 				<< png_filename << "." << std::endl;
-			fclose(png_file);
-			png_destroy_write_struct(&png_ptr, &info_ptr);
-			return 1;
 		}
-		png_init_io(png_ptr, png_file);
+	} else {
+		PngOutput output = { png_file, NULL };
+		success = WritePng(profile_settings[options.profile], header,
+			xyz_palette, xyz_pixels, row_decoder, output,
+			filename, png_filename, err);
+	}
 
-		// Set compression parameters
-		png_set_compression_level(png_ptr, Z_BEST_COMPRESSION);
-		png_set_compression_mem_level(png_ptr, MAX_MEM_LEVEL);
-		png_set_compression_buffer_size(png_ptr, 1024 * 1024);
+	if(to_stdout) {
+		if(fflush(stdout) != 0 && success) {
+			err << "Error writing to standard output." << std::endl;
+			success = false;
+		}
+		return success;
+	}
 
-		// Write header
-		if(setjmp(png_jmpbuf(png_ptr))) {
-			std::cerr << "Error writing PNG header for "
-				<< png_filename << "." << std::endl;
-			fclose(png_file);
-			png_destroy_write_struct(&png_ptr, &info_ptr);
+	fclose(png_file);
+
+	if(!success) {
+		remove(png_filename.c_str());
+	} else if(manifest != NULL) {
+		manifest->Update(filename, png_filename, settings, hash, size);
+	}
+
+	return success;
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	options.jobs = 1;
+	options.stream = false;
+	options.verify = false;
+	options.probe = ProbeNone;
+	options.probe_palette = false;
+	options.search = SearchNone;
+	options.type = TypePng;
+	options.profile = ProfileMax;
+	options.manifest = NULL;
+	std::string manifest_filename;
+	std::string output_dir;
+	bool recursive = false;
+	int arg = 1;
+
+	for(; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; arg++) {
+		std::string option = argv[arg];
+		if(option == "--") {
+			arg++;
+			break;
+		} else if(option == "-c") {
+			options.probe_palette = true;
+		} else if(option.compare(0, 2, "-f") == 0
+			|| option.compare(0, 2, "-k") == 0) {
+			std::string value = option.substr(2);
+			if(value.empty() && arg + 1 < argc) {
+				value = argv[++arg];
+			}
+			if(!ParseColor(value, options.search_color)) {
+				std::cerr << "Invalid color '" << value
+					<< "'." << std::endl;
+				return 1;
+			}
+			options.search = option[1] == 'f' ? SearchPalette : SearchKey;
+		} else if(option.compare(0, 2, "-i") == 0) {
+			std::string value = option.substr(2);
+			if(value.empty() && arg + 1 < argc) {
+				value = argv[++arg];
+			}
+			if(value == "json") {
+				options.probe = ProbeJson;
+			} else if(value == "csv") {
+				options.probe = ProbeCsv;
+			} else {
+				std::cerr << "Unknown probe format '" << value
+					<< "'." << std::endl;
+				return 1;
+			}
+		} else if(option.compare(0, 2, "-j") == 0) {
+			std::string value = option.substr(2);
+			if(value.empty() && arg + 1 < argc) {
+				value = argv[++arg];
+			}
+			if(!Xyz::WorkerPool::ParseSize(value, options.jobs)) {
+				std::cerr << "Invalid job count '" << value
+					<< "', use 0 (one per CPU) to "
+					<< Xyz::WorkerPool::GetMaxSize() << "." << std::endl;
+				return 1;
+			}
+		} else if(option.compare(0, 2, "-p") == 0) {
+			std::string value = option.substr(2);
+			if(value.empty() && arg + 1 < argc) {
+				value = argv[++arg];
+			}
+			int profile = ProfileFast;
+			while(profile <= ProfileSmallest
+				&& value != profile_names[profile]) {
+				profile++;
+			}
+			if(profile > ProfileSmallest) {
+				std::cerr << "Unknown profile '" << value
+					<< "'." << std::endl;
+				return 1;
+			}
+			options.profile = (Profile) profile;
+		} else if(option.compare(0, 2, "-m") == 0) {
+			manifest_filename = option.substr(2);
+			if(manifest_filename.empty() && arg + 1 < argc) {
+				manifest_filename = argv[++arg];
+			}
+			if(manifest_filename.empty()) {
+				std::cerr << "Missing manifest filename." << std::endl;
+				return 1;
+			}
+		} else if(option.compare(0, 2, "-o") == 0) {
+			output_dir = option.substr(2);
+			if(output_dir.empty() && arg + 1 < argc) {
+				output_dir = argv[++arg];
+			}
+			if(output_dir.empty()) {
+				std::cerr << "Missing output directory." << std::endl;
+				return 1;
+			}
+		} else if(option == "-r") {
+			recursive = true;
+		} else if(option == "-s") {
+			options.stream = true;
+		} else if(option.compare(0, 2, "-t") == 0) {
+			std::string value = option.substr(2);
+			if(value.empty() && arg + 1 < argc) {
+				value = argv[++arg];
+			}
+			int type = TypePng;
+			while(type <= TypeQoi && value != type_names[type]) {
+				type++;
+			}
+			if(type > TypeQoi) {
+				std::cerr << "Unknown output type '" << value
+					<< "'." << std::endl;
+				return 1;
+			}
+			options.type = (OutputType) type;
+		} else if(option == "-v") {
+			options.verify = true;
+		} else {
+			std::cerr << "Unknown option " << option << "."
+				<< std::endl;
 			return 1;
 		}
-		png_set_IHDR(png_ptr, info_ptr, width, height, 8,
-			PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE,
-			PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+	}
 
-		// Write palette
-		if(setjmp(png_jmpbuf(png_ptr))) {
-			std::cerr << "Error writing PNG palette for "
-				<< png_filename << "." << std::endl;
-			fclose(png_file);
-			png_destroy_write_struct(&png_ptr, &info_ptr);
+	if(arg >= argc)
+	{
+		std::cout << "Usage: " << argv[0]
+			<< " [options] filename [... filenameN]" << std::endl
+			<< std::endl
+			<< "  -c           include the palette in the probe report"
+			<< std::endl
+			<< "  -f color     only list the files whose palette contains"
+			<< " the color (rrggbb)" << std::endl
+			<< "               and the matching palette indices" << std::endl
+			<< "  -i format    only probe the image headers, prints a json"
+			<< " or csv report" << std::endl
+			<< "               to stdout, reads little more than the header"
+			<< std::endl
+			<< "  -j jobs      process this many files in parallel"
+			<< " (0: one per CPU)" << std::endl
+			<< "  -k color     only list the files whose color key"
+			<< " (palette index 0) is the color" << std::endl
+			<< "  -m manifest  skip files that are unchanged since the last"
+			<< " run with this manifest" << std::endl
+			<< "  -o dir       write the output files into this directory"
+			<< std::endl
+			<< "  -p profile   PNG compression: fast, balanced, max (default)"
+			<< " or smallest" << std::endl
+			<< "  -r           process all XYZ files in the given"
+			<< " directories and their" << std::endl
+			<< "               subdirectories, the directory structure is"
+			<< " mirrored in the output" << std::endl
+			<< "  -s           stream rows, memory use does not depend on"
+			<< " the image size (not with smallest)" << std::endl
+			<< "  -t type      output file type: png (default), bmp, ppm"
+			<< " or qoi" << std::endl
+			<< "  -v           only verify the files, prints one line per"
+			<< " file to stdout:" << std::endl
+			<< "               result, width, height, inflated size,"
+			<< " trailing size, filename" << std::endl
+			<< std::endl
+			<< "A filename of - converts standard input to standard output."
+			<< std::endl;
+		return 1;
+	}
+
+	Xyz::Manifest manifest;
+	if(!manifest_filename.empty() && !options.verify
+		&& options.probe == ProbeNone && options.search == SearchNone) {
+		if(!manifest.Load(manifest_filename)) {
+			std::cerr << "Error reading manifest "
+				<< manifest_filename << "." << std::endl;
 			return 1;
 		}
-		png_colorp palette = (png_colorp) png_malloc(png_ptr,
-			PNG_MAX_PALETTE_LENGTH * (sizeof (png_color)));
-
-	 	for(int i = 0; i < PNG_MAX_PALETTE_LENGTH; i++)
-		{
-			palette[i].red = xyz_data[i * 3];
-			palette[i].green = xyz_data[i * 3 + 1];
-			palette[i].blue = xyz_data[i * 3 + 2];
-		}
-		png_set_PLTE(png_ptr, info_ptr, palette,
-			PNG_MAX_PALETTE_LENGTH);
+		options.manifest = &manifest;
+	}
+
+	std::mutex output_mutex;
+	int failed = 0;
+	int total = 0;
+	bool walk_failed = false;
+	bool first_record = true;
+
+	if(options.probe == ProbeJson) {
+		std::cout << "[";
+	} else if(options.probe == ProbeCsv) {
+		std::cout << "filename,result,width,height,compressed_size"
+			<< (options.probe_palette ? ",palette" : "") << "\n";
+	}
+
+	std::string extension = std::string(".") + type_names[options.type];
+
+	// Source of every output file, e.g. d1/a.xyz and d2/a.xyz with -o
+	std::map<std::string, std::string> sources;
+
+	{
+		Xyz::WorkerPool pool(options.jobs);
+
+		auto submit = [&](const std::string& filename,
+			const std::string& out_filename) {
+			total++;
+			// Checks write nothing, a file may be listed twice
+			if(!options.verify && options.probe == ProbeNone
+				&& options.search == SearchNone && !sources.insert(
+				std::make_pair(out_filename, filename)).second) {
+				std::lock_guard<std::mutex> lock(output_mutex);
+				std::cerr << "Skipping " << filename << ", "
+					<< sources[out_filename] << " is converted to "
+					<< out_filename << " already." << std::endl;
+				failed++;
+				return;
+			}
+
+			pool.Submit([filename, out_filename, &options, &output_mutex,
+				&failed, &first_record]() {
+				std::ostringstream err;
+				std::ostringstream report;
+				bool success;
+				if(options.probe != ProbeNone) {
+					success = ProbeFile(filename, options, report);
+				} else if(options.search != SearchNone) {
+					success = SearchFile(filename, options, report, err);
+				} else if(options.verify) {
+					success = VerifyFile(filename, report);
+				} else {
+					thread_local WorkerContext context;
+					success = ConvertFile(filename, out_filename, options,
+						context, err);
+					context.input.Close();
+				}
 
-		png_write_info(png_ptr, info_ptr);
+				std::lock_guard<std::mutex> lock(output_mutex);
+				if(options.probe == ProbeJson) {
+					std::cout << (first_record ? "\n" : ",\n");
+					first_record = false;
+				}
+				std::cout << report.str();
+				std::cerr << err.str();
+				if(!success) {
+					failed++;
+				}
+			});
+		};
 
-		png_bytep* row_pointers = new png_bytep[height];
-		for(int i = 0; i < height; i++) {
-			row_pointers[i] =
-				&xyz_data[768 + width * i];
+		for(; arg < argc; arg++) {
+			std::string filename = argv[arg];
+
+			// Standard input is converted to standard output
+			if(filename == "-") {
+				submit(filename, filename);
+				continue;
+			}
+
+			if(!recursive) {
+				submit(filename, GetOutputFilename(output_dir,
+					GetFilename(filename) + extension));
+				continue;
+			}
+
+			// Files are converted while the tree is still being walked
+			bool walked = Xyz::WalkDirectory(filename, ".xyz",
+				[&](const std::string& relative) {
+				submit(filename + "/" + relative, GetOutputFilename(output_dir,
+					relative.substr(0, relative.size() - 4) + extension));
+			});
+			if(!walked) {
+				std::lock_guard<std::mutex> lock(output_mutex);
+				std::cerr << "Error reading directory "
+					<< filename << "." << std::endl;
+				walk_failed = true;
+			}
 		}
-		png_write_image(png_ptr, row_pointers);
-		delete[] row_pointers;
-	
-		png_write_end(png_ptr, info_ptr);
 
-		png_free(png_ptr, palette);
-		palette = NULL;
+		pool.Wait();
+	}
 
-		png_destroy_write_struct(&png_ptr, &info_ptr);
+	if(options.probe == ProbeJson) {
+		std::cout << (first_record ? "]" : "\n]") << std::endl;
+	}
 
-		fclose(png_file);
+	if(options.manifest != NULL && !manifest.Save(manifest_filename)) {
+		std::cerr << "Error writing manifest "
+			<< manifest_filename << "." << std::endl;
+		return 1;
+	}
+
+	if(failed > 0) {
+		std::cerr << failed << " of " << total << " files failed to "
+			<< (options.probe != ProbeNone ? "probe" :
+				options.search != SearchNone ? "search" :
+				options.verify ? "verify" : "convert") << "." << std::endl;
+		return 1;
 	}
 
-	return 0;
+	return walk_failed ? 1 : 0;
 }
@@ -0,0 +1,331 @@
+/*
+ * This file is part of xyz2png. Copyright (c) 2015 xyz2png authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Writes images as BMP, PPM and QOI, from a whole image and row by row
+ * through a decoder, decodes the files again and compares them with the
+ * RGB colors of the source image.
+ */
+
+#include "image_writer.h"
+#include <xyz.h>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+	int failures = 0;
+
+	void Check(bool condition, const std::string& what) {
+		if(!condition) {
+			std::cerr << "FAIL: " << what << std::endl;
+			failures++;
+		}
+	}
+
+	unsigned long LoadLittleEndian(const unsigned char* in, int bytes) {
+		unsigned long value = 0;
+		for(int i = bytes - 1; i >= 0; i--) {
+			value = (value << 8) | in[i];
+		}
+		return value;
+	}
+
+	unsigned long LoadBigEndian(const unsigned char* in, int bytes) {
+		unsigned long value = 0;
+		for(int i = 0; i < bytes; i++) {
+			value = (value << 8) | in[i];
+		}
+		return value;
+	}
+
+	/** Reads the whole contents of a temporary file. */
+	std::vector<unsigned char> ReadAll(FILE* file) {
+		std::vector<unsigned char> data;
+		unsigned char chunk[4096];
+		size_t read;
+		rewind(file);
+		while((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+			data.insert(data.end(), chunk, chunk + read);
+		}
+		return data;
+	}
+
+	/** Decodes an 8 bit BMP to RGB, top row first. */
+	bool DecodeBmp(const std::vector<unsigned char>& data,
+		const Xyz::Header& header, std::vector<unsigned char>& rgb) {
+		if(data.size() < 54 || data[0] != 'B' || data[1] != 'M' ||
+			LoadLittleEndian(&data[2], 4) != data.size() ||
+			LoadLittleEndian(&data[18], 4) != header.width ||
+			LoadLittleEndian(&data[28], 2) != 8) {
+			return false;
+		}
+		long height = (long) (int) LoadLittleEndian(&data[22], 4);
+		bool top_down = height < 0;
+		if((top_down ? -height : height) != header.height) {
+			return false;
+		}
+
+		size_t offset = LoadLittleEndian(&data[10], 4);
+		size_t stride = (header.width + 3) & ~(size_t) 3;
+		if(offset + stride * header.height != data.size()) {
+			return false;
+		}
+
+		rgb.resize((size_t) header.width * header.height * 3);
+		for(size_t y = 0; y < header.height; y++) {
+			size_t file_y = top_down ? y : header.height - 1 - y;
+			const unsigned char* row = &data[offset + file_y * stride];
+			for(size_t x = 0; x < header.width; x++) {
+				const unsigned char* bgr = &data[54 + row[x] * 4];
+				unsigned char* out = &rgb[(y * header.width + x) * 3];
+				out[0] = bgr[2];
+				out[1] = bgr[1];
+				out[2] = bgr[0];
+			}
+		}
+		return true;
+	}
+
+	/** Decodes a binary PPM to RGB. */
+	bool DecodePpm(const std::vector<unsigned char>& data,
+		const Xyz::Header& header, std::vector<unsigned char>& rgb) {
+		std::ostringstream expected;
+		expected << "P6\n" << header.width << " " << header.height
+			<< "\n255\n";
+		std::string magic = expected.str();
+		size_t size = (size_t) header.width * header.height * 3;
+		if(data.size() != magic.size() + size ||
+			memcmp(data.data(), magic.data(), magic.size()) != 0) {
+			return false;
+		}
+		rgb.assign(data.begin() + magic.size(), data.end());
+		return true;
+	}
+
+	/** Decodes a 3 channel QOI to RGB, following the specification. */
+	bool DecodeQoi(const std::vector<unsigned char>& data,
+		const Xyz::Header& header, std::vector<unsigned char>& rgb) {
+		const unsigned char end_marker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+		if(data.size() < 22 || memcmp(data.data(), "qoif", 4) != 0 ||
+			LoadBigEndian(&data[4], 4) != header.width ||
+			LoadBigEndian(&data[8], 4) != header.height ||
+			data[12] != 3 ||
+			memcmp(&data[data.size() - 8], end_marker, 8) != 0) {
+			return false;
+		}
+
+		unsigned char pixel[4] = { 0, 0, 0, 255 };
+		unsigned char seen[64][4];
+		memset(seen, 0, sizeof(seen));
+		size_t count = (size_t) header.width * header.height;
+		size_t pos = 14;
+		size_t end = data.size() - 8;
+		rgb.clear();
+		while(rgb.size() < count * 3) {
+			if(pos >= end) {
+				return false;
+			}
+			int run = 1;
+			unsigned char op = data[pos++];
+			if(op == 0xFE) {
+				if(pos + 3 > end) {
+					return false;
+				}
+				memcpy(pixel, &data[pos], 3);
+				pos += 3;
+			} else if(op == 0xFF) {
+				return false;
+			} else if((op & 0xC0) == 0x00) {
+				memcpy(pixel, seen[op], 4);
+			} else if((op & 0xC0) == 0x40) {
+				pixel[0] += ((op >> 4) & 3) - 2;
+				pixel[1] += ((op >> 2) & 3) - 2;
+				pixel[2] += (op & 3) - 2;
+			} else if((op & 0xC0) == 0x80) {
+				if(pos >= end) {
+					return false;
+				}
+				int dg = (op & 0x3F) - 32;
+				unsigned char second = data[pos++];
+				pixel[0] += dg + (second >> 4) - 8;
+				pixel[1] += dg;
+				pixel[2] += dg + (second & 0xF) - 8;
+			} else {
+				run = (op & 0x3F) + 1;
+			}
+			int hash = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 +
+				pixel[3] * 11) % 64;
+			memcpy(seen[hash], pixel, 4);
+			for(int i = 0; i < run; i++) {
+				rgb.insert(rgb.end(), pixel, pixel + 3);
+			}
+		}
+		return pos == end && rgb.size() == count * 3;
+	}
+
+	struct Image {
+		std::string name;
+		Xyz::Header header;
+		std::vector<unsigned char> palette;
+		std::vector<unsigned char> pixels;
+		std::vector<unsigned char> encoded;
+		std::vector<unsigned char> rgb;
+	};
+
+	/**
+	 * Creates an image whose width needs BMP row padding. Runs, repeated
+	 * colors and small and large color steps exercise every QOI chunk.
+	 */
+	Image MakeImage(const std::string& name, unsigned short width,
+		unsigned short height) {
+		Image image;
+		image.name = name;
+		image.header.width = width;
+		image.header.height = height;
+		image.palette.resize(Xyz::PaletteSize);
+		for(size_t i = 0; i < 256; i++) {
+			image.palette[i * 3] = i;
+			image.palette[i * 3 + 1] = (i * 7) & 0xFF;
+			image.palette[i * 3 + 2] = i < 128 ? i / 2 : 255 - i;
+		}
+		image.pixels.resize(Xyz::GetPixelsSize(image.header));
+		unsigned seed = 1;
+		for(size_t i = 0; i < image.pixels.size(); i++) {
+			seed = seed * 1103515245 + 12345;
+			size_t x = i % width;
+			if(x < width / 4) {
+				image.pixels[i] = 3;
+			} else if(x < width / 2) {
+				image.pixels[i] = x & 1 ? 10 : 11;
+			} else {
+				image.pixels[i] = (seed >> 16) & 0xFF;
+			}
+		}
+
+		image.rgb.resize(image.pixels.size() * 3);
+		for(size_t i = 0; i < image.pixels.size(); i++) {
+			memcpy(&image.rgb[i * 3], &image.palette[image.pixels[i] * 3], 3);
+		}
+
+		size_t size = Xyz::GetEncodeBound(image.header);
+		image.encoded.resize(size);
+		Xyz::Result result = Xyz::Encode(image.header, image.palette.data(),
+			image.pixels.data(), image.encoded.data(), size);
+		Check(result == Xyz::Ok, name + ": encode");
+		image.encoded.resize(size);
+		return image;
+	}
+
+	enum Type {
+		TypeBmp,
+		TypePpm,
+		TypeQoi
+	};
+
+	const char* const type_names[] = { "bmp", "ppm", "qoi" };
+
+	/** Writes an image with a writer and compares the decoded file. */
+	void CheckWriter(const Image& image, Type type, bool rows) {
+		std::string what = image.name + " " + type_names[type] +
+			(rows ? " by rows" : "");
+		FILE* file = tmpfile();
+		if(file == NULL) {
+			Check(false, what + ": temporary file");
+			return;
+		}
+
+		Xyz::Decoder decoder;
+		std::vector<unsigned char> pixels(image.pixels);
+		std::vector<unsigned char> palette(image.palette);
+		if(rows) {
+			pixels.resize(image.header.width);
+			Check(decoder.Begin(image.encoded.data(), image.encoded.size())
+				== Xyz::Ok && decoder.ReadPalette(palette.data()) == Xyz::Ok,
+				what + ": decoder");
+		}
+
+		std::ostringstream err;
+		std::vector<unsigned char> row;
+		Xyz::Decoder* row_decoder = rows ? &decoder : NULL;
+		bool success = false;
+		if(type == TypeBmp) {
+			success = WriteBmp(image.header, palette.data(), pixels.data(),
+				row_decoder, file, "in", "out", err);
+		} else if(type == TypePpm) {
+			success = WritePpm(image.header, palette.data(), pixels.data(),
+				row_decoder, file, row, "in", "out", err);
+		} else {
+			success = WriteQoi(image.header, palette.data(), pixels.data(),
+				row_decoder, file, row, "in", "out", err);
+		}
+		Check(success && err.str().empty(), what + ": write " + err.str());
+
+		std::vector<unsigned char> data = ReadAll(file);
+		fclose(file);
+
+		std::vector<unsigned char> rgb;
+		bool decoded = type == TypeBmp ? DecodeBmp(data, image.header, rgb) :
+			type == TypePpm ? DecodePpm(data, image.header, rgb) :
+			DecodeQoi(data, image.header, rgb);
+		Check(decoded, what + ": decode");
+		Check(decoded && rgb == image.rgb, what + ": colors");
+	}
+}
+
+int main() {
+	std::vector<Image> images;
+	images.push_back(MakeImage("1x1", 1, 1));
+	images.push_back(MakeImage("padded", 37, 5));
+	images.push_back(MakeImage("large", 301, 64));
+
+	for(size_t i = 0; i < images.size(); i++) {
+		for(int type = TypeBmp; type <= TypeQoi; type++) {
+			CheckWriter(images[i], static_cast<Type>(type), false);
+			CheckWriter(images[i], static_cast<Type>(type), true);
+		}
+	}
+
+	// A corrupt stream is reported instead of written silently
+	Image broken = images[2];
+	broken.encoded.resize(broken.encoded.size() / 2);
+	FILE* file = tmpfile();
+	Xyz::Decoder decoder;
+	std::vector<unsigned char> palette(Xyz::PaletteSize);
+	std::vector<unsigned char> row(broken.header.width);
+	std::ostringstream err;
+	bool begun = file != NULL &&
+		decoder.Begin(broken.encoded.data(), broken.encoded.size()) ==
+		Xyz::Ok && decoder.ReadPalette(palette.data()) == Xyz::Ok;
+	Check(begun, "truncated: decoder");
+	if(begun) {
+		Check(!WriteBmp(broken.header, palette.data(), row.data(), &decoder,
+			file, "in", "out", err), "truncated: bmp fails");
+		Check(!err.str().empty(), "truncated: error reported");
+	}
+	if(file != NULL) {
+		fclose(file);
+	}
+
+	if(failures != 0) {
+		std::cerr << failures << " checks failed." << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * This file is part of xyzcrush. Copyright (c) 2018 xyzcrush authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <xyz_file.h>
+#include "crush_cache.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+namespace {
+	const char* const signature = "XYZCRUSHCACHE 1";
+}
+
+CrushCache::CrushCache() {
+}
+
+bool CrushCache::Load(const std::string& filename) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if(!in) {
+		// Nothing crushed yet
+		FILE* file = fopen(filename.c_str(), "rb");
+		if(file != NULL) {
+			fclose(file);
+			return false;
+		}
+		return true;
+	}
+
+	std::string line;
+	if(!std::getline(in, line) || line != signature) {
+		return false;
+	}
+
+	std::map<unsigned long long, CrushResult> loaded;
+	while(std::getline(in, line)) {
+		std::vector<std::string> fields = Xyz::SplitFields(line);
+		unsigned long long hash;
+		unsigned long long size;
+		unsigned long long passes;
+		if(fields.size() != 4 || !Xyz::ParseNumber(fields[0], 16, hash)
+			|| !Xyz::ParseNumber(fields[1], 10, size)
+			|| !Xyz::ParseNumber(fields[2], 10, passes)
+			|| fields[3].empty()) {
+			return false;
+		}
+		CrushResult& result = loaded[hash];
+		result.size = size;
+		result.passes = passes;
+		result.settings = fields[3];
+	}
+
+	if(in.bad()) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	entries.swap(loaded);
+	return true;
+}
+
+bool CrushCache::Save(const std::string& filename) const {
+	std::ostringstream out;
+	out << signature << '\n';
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<unsigned long long, CrushResult>::const_iterator it;
+		for(it = entries.begin(); it != entries.end(); ++it) {
+			out << std::hex << it->first << std::dec << '\t'
+				<< it->second.size << '\t' << it->second.passes << '\t'
+				<< it->second.settings << '\n';
+		}
+	}
+
+	std::string contents = out.str();
+	return Xyz::ReplaceFile(filename,
+		reinterpret_cast<const unsigned char*>(contents.data()),
+		contents.size());
+}
+
+bool CrushCache::Find(unsigned long long hash, CrushResult& result) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<unsigned long long, CrushResult>::const_iterator it =
+		entries.find(hash);
+	if(it == entries.end()) {
+		return false;
+	}
+	result = it->second;
+	return true;
+}
+
+void CrushCache::Store(unsigned long long hash, const CrushResult& result) {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<unsigned long long, CrushResult>::iterator it =
+		entries.find(hash);
+	if(it == entries.end()) {
+		entries[hash] = result;
+		return;
+	}
+
+	CrushResult& entry = it->second;
+	int passes = entry.passes > result.passes ? entry.passes : result.passes;
+	if(result.size < entry.size) {
+		entry = result;
+	}
+	entry.passes = passes;
+}
@@ -0,0 +1,91 @@
+/*
+ * This file is part of xyzcrush. Copyright (c) 2018 xyzcrush authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef XYZCRUSH_CRUSH_CACHE_H
+#define XYZCRUSH_CRUSH_CACHE_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+
+/** Smallest encoding found for an image. */
+struct CrushResult {
+	/** Size of the XYZ file. */
+	size_t size;
+	/** Optimal deflate passes of the run that found it, 0 for zlib only. */
+	int passes;
+	/** Settings that produced it, "-" when nothing beat the input file. */
+	std::string settings;
+};
+
+/**
+ * Persistent record of the best encodings found by previous runs.
+ *
+ * Entries are keyed by the hash of the decoded palette and pixels, so
+ * they survive renames, copies and files that png2xyz wrote again from
+ * an unchanged image. The cache is a text file with one tab separated
+ * line per image. All methods may be called from several threads at
+ * once.
+ */
+class CrushCache {
+public:
+	CrushCache();
+
+	/**
+	 * Reads a cache file, a missing file gives an empty cache.
+	 *
+	 * @param filename path of the cache
+	 * @return false when the file exists but cannot be read or parsed
+	 */
+	bool Load(const std::string& filename);
+
+	/**
+	 * Writes the cache file through a temporary file.
+	 *
+	 * @param filename path of the cache
+	 * @return whether the file could be written
+	 */
+	bool Save(const std::string& filename) const;
+
+	/**
+	 * Looks up the best result for an image.
+	 *
+	 * @param hash hash of palette and pixels
+	 * @param result receives the entry
+	 * @return whether the image is known
+	 */
+	bool Find(unsigned long long hash, CrushResult& result) const;
+
+	/**
+	 * Records a result. An existing entry keeps the smaller size and the
+	 * higher number of passes.
+	 *
+	 * @param hash hash of palette and pixels
+	 * @param result result of the current run
+	 */
+	void Store(unsigned long long hash, const CrushResult& result);
+
+private:
+	CrushCache(const CrushCache&);
+	CrushCache& operator=(const CrushCache&);
+
+	mutable std::mutex mutex;
+	std::map<unsigned long long, CrushResult> entries;
+};
+
+#endif
@@ -0,0 +1,827 @@
+/*
+ * This file is part of xyzcrush. Copyright (c) 2018 xyzcrush authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "optimal_deflate.h"
+#include <zlib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+	const size_t WindowSize = 32768;
+	const size_t WindowMask = WindowSize - 1;
+	const size_t MinMatch = 3;
+	const size_t MaxMatch = 258;
+	const size_t HashSize = 1 << 16;
+
+	/** Input handled by one match search and shortest path search. */
+	const size_t MasterBlockSize = 1 << 20;
+
+	/** Candidates compared per position, like zlib level 9 does. */
+	const int MaxChainLength = 4096;
+
+	/**
+	 * Matches kept per position. Dropping the short ones only makes them
+	 * use the distance of a longer match.
+	 */
+	const size_t MaxCachedMatches = 8;
+
+	/** Splitting stops after 2^MaxSplitDepth blocks per master block. */
+	const int MaxSplitDepth = 4;
+
+	/** Smallest number of symbols in a block created by splitting. */
+	const size_t MinBlockSymbols = 1024;
+
+	/** Largest length of a stored block. */
+	const size_t MaxStoredSize = 65535;
+
+	const int MaxBits = 15;
+	const int MaxCodeLengthBits = 7;
+
+	/** Order of the code length code lengths in a dynamic block header. */
+	const int code_length_order[19] = {
+		16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+	};
+
+	int FloorLog2(unsigned value) {
+		int log = 0;
+		while(value >>= 1) {
+			log++;
+		}
+		return log;
+	}
+
+	int GetLengthSymbol(size_t length) {
+		unsigned value = length - 3;
+		if(length == MaxMatch) {
+			return 285;
+		}
+		if(value < 8) {
+			return 257 + value;
+		}
+		int log = FloorLog2(value);
+		return 257 + 4 * (log - 1) + ((value >> (log - 2)) & 3);
+	}
+
+	int GetLengthExtraBits(size_t length) {
+		unsigned value = length - 3;
+		if(length == MaxMatch || value < 8) {
+			return 0;
+		}
+		return FloorLog2(value) - 2;
+	}
+
+	unsigned GetLengthExtraValue(size_t length) {
+		return (length - 3) & ((1u << GetLengthExtraBits(length)) - 1);
+	}
+
+	int GetDistSymbol(size_t dist) {
+		unsigned value = dist - 1;
+		if(value < 4) {
+			return value;
+		}
+		int log = FloorLog2(value);
+		return 2 * log + ((value >> (log - 1)) & 1);
+	}
+
+	int GetDistExtraBits(size_t dist) {
+		unsigned value = dist - 1;
+		return value < 4 ? 0 : FloorLog2(value) - 1;
+	}
+
+	unsigned GetDistExtraValue(size_t dist) {
+		return (dist - 1) & ((1u << GetDistExtraBits(dist)) - 1);
+	}
+
+	/** Code lengths of the fixed Huffman codes. */
+	int GetFixedLength(int litlen) {
+		return litlen < 144 ? 8 : (litlen < 256 ? 9 : (litlen < 280 ? 7 : 8));
+	}
+
+	/** Node of the package merge, a leaf or a package of two nodes. */
+	struct Node {
+		unsigned long long weight;
+		int symbol;
+		int left;
+		int right;
+	};
+
+	/**
+	 * Computes optimal length limited Huffman code lengths with the
+	 * package merge algorithm. Unused symbols get length 0. At least two
+	 * symbols get a code, as some decoders reject a single one.
+	 */
+	void BuildLengths(const unsigned* counts, int n, int max_bits,
+		unsigned char* lengths) {
+		memset(lengths, 0, n);
+
+		std::vector<Node> nodes;
+		for(int i = 0; i < n; i++) {
+			if(counts[i] > 0) {
+				Node leaf = { counts[i], i, -1, -1 };
+				nodes.push_back(leaf);
+			}
+		}
+
+		if(nodes.size() < 2) {
+			for(int i = 0; i < n && nodes.size() < 2; i++) {
+				if(nodes.empty() || nodes[0].symbol != i) {
+					Node leaf = { 1, i, -1, -1 };
+					nodes.push_back(leaf);
+				}
+			}
+			lengths[nodes[0].symbol] = 1;
+			lengths[nodes[1].symbol] = 1;
+			return;
+		}
+
+		std::stable_sort(nodes.begin(), nodes.end(),
+			[](const Node& a, const Node& b) { return a.weight < b.weight; });
+
+		size_t leaf_count = nodes.size();
+		size_t limit = 2 * leaf_count - 2;
+		std::vector<int> list(leaf_count);
+		for(size_t i = 0; i < leaf_count; i++) {
+			list[i] = i;
+		}
+
+		std::vector<int> merged;
+		for(int level = 1; level < max_bits; level++) {
+			merged.clear();
+			size_t leaf = 0;
+			size_t package = 0;
+			size_t packages = list.size() / 2;
+			while(merged.size() < limit
+				&& (leaf < leaf_count || package < packages)) {
+				unsigned long long weight = package < packages ?
+					nodes[list[package * 2]].weight
+					+ nodes[list[package * 2 + 1]].weight : 0;
+				if(package >= packages
+					|| (leaf < leaf_count && nodes[leaf].weight <= weight)) {
+					merged.push_back(leaf++);
+				} else {
+					Node node = { weight, -1, list[package * 2],
+						list[package * 2 + 1] };
+					nodes.push_back(node);
+					merged.push_back(nodes.size() - 1);
+					package++;
+				}
+			}
+			list.swap(merged);
+		}
+
+		// Every occurrence of a leaf in the chosen items adds one bit
+		std::vector<int> stack;
+		for(size_t i = 0; i < limit && i < list.size(); i++) {
+			stack.push_back(list[i]);
+			while(!stack.empty()) {
+				const Node& node = nodes[stack.back()];
+				stack.pop_back();
+				if(node.symbol >= 0) {
+					lengths[node.symbol]++;
+				} else {
+					stack.push_back(node.left);
+					stack.push_back(node.right);
+				}
+			}
+		}
+	}
+
+	/** Assigns the canonical Huffman codes of deflate to code lengths. */
+	void GetCodes(const unsigned char* lengths, int n, unsigned* codes) {
+		unsigned count[MaxBits + 1] = { 0 };
+		for(int i = 0; i < n; i++) {
+			count[lengths[i]]++;
+		}
+		count[0] = 0;
+
+		unsigned next[MaxBits + 1];
+		unsigned code = 0;
+		for(int bits = 1; bits <= MaxBits; bits++) {
+			code = (code + count[bits - 1]) << 1;
+			next[bits] = code;
+		}
+
+		for(int i = 0; i < n; i++) {
+			codes[i] = lengths[i] > 0 ? next[lengths[i]]++ : 0;
+		}
+	}
+
+	int GetCodeLengthExtraBits(int symbol) {
+		return symbol == 16 ? 2 : (symbol == 17 ? 3 : (symbol == 18 ? 7 : 0));
+	}
+}
+
+struct OptimalDeflate::BlockCode {
+	bool dynamic;
+	/** Size of the block in bits, including its header. */
+	double bits;
+	/** Input bytes of the block. */
+	size_t bytes;
+	/** Size as stored blocks in bits, assuming the worst padding. */
+	double stored_bits;
+
+	unsigned char litlen_lengths[288];
+	unsigned char dist_lengths[30];
+
+	/** Dynamic block header. */
+	int litlen_count;
+	int dist_count;
+	int code_length_count;
+	unsigned char code_length_lengths[19];
+	/** Run length encoded code lengths and their extra bits. */
+	std::vector<unsigned char> code_lengths;
+	std::vector<unsigned char> code_length_extra;
+};
+
+OptimalDeflate::OptimalDeflate(int iterations) : iterations(iterations),
+	data(NULL), size(0), out(NULL), bit_buffer(0), bit_count(0) {
+}
+
+void OptimalDeflate::GetFixedCostModel(CostModel& model) {
+	for(int i = 0; i < 256; i++) {
+		model.literal[i] = GetFixedLength(i);
+	}
+	for(size_t i = MinMatch; i <= MaxMatch; i++) {
+		model.length[i] = GetFixedLength(GetLengthSymbol(i))
+			+ GetLengthExtraBits(i);
+	}
+	for(int i = 0; i < 30; i++) {
+		model.dist[i] = 5;
+	}
+}
+
+void OptimalDeflate::GetCostModel(const std::vector<Symbol>& symbols,
+	CostModel& model) {
+	unsigned litlen_counts[288] = { 0 };
+	unsigned dist_counts[30] = { 0 };
+	for(size_t i = 0; i < symbols.size(); i++) {
+		const Symbol& symbol = symbols[i];
+		if(symbol.dist == 0) {
+			litlen_counts[symbol.litlen]++;
+		} else {
+			litlen_counts[GetLengthSymbol(symbol.litlen)]++;
+			dist_counts[GetDistSymbol(symbol.dist)]++;
+		}
+	}
+	litlen_counts[256] = 1;
+
+	// Entropy of each symbol, unused symbols cost as much as rare ones
+	double litlen_bits[288];
+	double dist_bits[30];
+	unsigned total = 0;
+	for(int i = 0; i < 288; i++) {
+		total += litlen_counts[i];
+	}
+	double log_total = log2((double) total);
+	for(int i = 0; i < 288; i++) {
+		litlen_bits[i] = litlen_counts[i] == 0 ? log_total :
+			log_total - log2((double) litlen_counts[i]);
+	}
+
+	total = 0;
+	for(int i = 0; i < 30; i++) {
+		total += dist_counts[i];
+	}
+	log_total = total == 0 ? 0 : log2((double) total);
+	for(int i = 0; i < 30; i++) {
+		dist_bits[i] = dist_counts[i] == 0 ? log_total :
+			log_total - log2((double) dist_counts[i]);
+	}
+
+	for(int i = 0; i < 256; i++) {
+		model.literal[i] = litlen_bits[i];
+	}
+	for(size_t i = MinMatch; i <= MaxMatch; i++) {
+		model.length[i] = litlen_bits[GetLengthSymbol(i)]
+			+ GetLengthExtraBits(i);
+	}
+	for(int i = 0; i < 30; i++) {
+		model.dist[i] = dist_bits[i];
+	}
+}
+
+double OptimalDeflate::GetDistCost(const CostModel& model, size_t dist) {
+	return model.dist[GetDistSymbol(dist)] + GetDistExtraBits(dist);
+}
+
+void OptimalDeflate::Compress(const unsigned char* data, size_t size,
+	std::vector<unsigned char>& out) {
+	this->data = data;
+	this->size = size;
+	this->out = &out;
+	bit_buffer = 0;
+	bit_count = 0;
+
+	// zlib header: deflate with 32 KiB window, maximum compression
+	out.clear();
+	out.push_back(0x78);
+	out.push_back(0xDA);
+
+	head.assign(HashSize, -1);
+	prev.assign(WindowSize, -1);
+
+	std::vector<Symbol> symbols;
+	std::vector<Symbol> best;
+	std::vector<size_t> splits;
+	CostModel model;
+
+	size_t offset = 0;
+	if(size == 0) {
+		WriteBlock(symbols, 0, 0, offset, true);
+	}
+
+	for(size_t start = 0; start < size; start += MasterBlockSize) {
+		size_t end = std::min(start + MasterBlockSize, size);
+		FindMatches(start, end);
+
+		// Every pass uses the statistics of the previous one
+		GetFixedCostModel(model);
+		Parse(start, end, model, symbols);
+		best = symbols;
+		double best_cost = GetBlockCost(best, 0, best.size());
+		double last_cost = best_cost;
+		for(int i = 0; i < iterations; i++) {
+			GetCostModel(symbols, model);
+			Parse(start, end, model, symbols);
+			double cost = GetBlockCost(symbols, 0, symbols.size());
+			if(cost < best_cost) {
+				best = symbols;
+				best_cost = cost;
+			}
+
+			// The same cost model would produce the same parse again
+			if(cost == last_cost) {
+				break;
+			}
+			last_cost = cost;
+		}
+
+		splits.clear();
+		SplitBlocks(best, 0, best.size(), 0, splits);
+		splits.push_back(best.size());
+
+		size_t begin = 0;
+		for(size_t i = 0; i < splits.size(); i++) {
+			WriteBlock(best, begin, splits[i], offset,
+				end == size && i + 1 == splits.size());
+			begin = splits[i];
+		}
+	}
+
+	if(bit_count > 0) {
+		out.push_back(bit_buffer & 0xFF);
+	}
+
+	uLong adler = adler32(0L, Z_NULL, 0);
+	for(size_t offset = 0; offset < size; ) {
+		uInt chunk = (uInt) std::min<size_t>(size - offset, 1u << 30);
+		adler = adler32(adler, data + offset, chunk);
+		offset += chunk;
+	}
+	out.push_back((adler >> 24) & 0xFF);
+	out.push_back((adler >> 16) & 0xFF);
+	out.push_back((adler >> 8) & 0xFF);
+	out.push_back(adler & 0xFF);
+}
+
+void OptimalDeflate::FindMatches(size_t start, size_t end) {
+	size_t n = end - start;
+	matches.clear();
+	match_offsets.resize(n + 1);
+	same.resize(n);
+
+	same[n - 1] = 0;
+	for(size_t i = n - 1; i-- > 0; ) {
+		same[i] = data[start + i] == data[start + i + 1] ?
+			std::min(same[i + 1] + 1, 0xFFFF) : 0;
+	}
+
+	Match found[MaxMatch];
+	for(size_t i = 0; i < n; i++) {
+		size_t pos = start + i;
+		size_t limit = std::min(MaxMatch, n - i);
+		size_t count = 0;
+		match_offsets[i] = matches.size();
+
+		unsigned hash = 0;
+		if(pos + 2 < size) {
+			hash = ((data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16))
+				* 2654435761u) >> 16;
+		}
+
+		// Chains are walked from the nearest position, so the first match
+		// of each length has the smallest distance
+		if(limit >= MinMatch && pos + 2 < size) {
+			size_t best = MinMatch - 1;
+			const unsigned char* current = data + pos;
+			int chain = 0;
+			for(int candidate = head[hash]; candidate >= 0
+				&& pos - candidate <= WindowSize && chain < MaxChainLength;
+				candidate = prev[candidate & WindowMask], chain++) {
+				const unsigned char* match = data + candidate;
+				if(match[best] != current[best]) {
+					continue;
+				}
+				size_t length = 0;
+				while(length < limit && match[length] == current[length]) {
+					length++;
+				}
+				if(length > best) {
+					best = length;
+					found[count].length = length;
+					found[count].dist = pos - candidate;
+					count++;
+					if(length == limit) {
+						break;
+					}
+				}
+			}
+		}
+
+		size_t first = count > MaxCachedMatches ? count - MaxCachedMatches : 0;
+		matches.insert(matches.end(), found + first, found + count);
+
+		if(pos + 2 < size) {
+			prev[pos & WindowMask] = head[hash];
+			head[hash] = pos;
+		}
+	}
+	match_offsets[n] = matches.size();
+}
+
+size_t OptimalDeflate::GetMatchDist(size_t offset, size_t length) const {
+	for(size_t i = match_offsets[offset]; i < match_offsets[offset + 1]; i++) {
+		if(matches[i].length >= length) {
+			return matches[i].dist;
+		}
+	}
+	return 0;
+}
+
+void OptimalDeflate::Parse(size_t start, size_t end, const CostModel& model,
+	std::vector<Symbol>& symbols) {
+	size_t n = end - start;
+	costs.assign(n + 1, std::numeric_limits<float>::infinity());
+	lengths.assign(n + 1, 0);
+	costs[0] = 0;
+
+	double run_cost = model.length[MaxMatch] + GetDistCost(model, 1);
+	size_t i = 0;
+	while(i < n) {
+		// Inside long runs the longest match is taken without searching
+		if(same[i] > MaxMatch * 2 && i > MaxMatch + 1
+			&& i + MaxMatch * 2 + 1 < n && same[i - MaxMatch] > MaxMatch) {
+			for(size_t k = 0; k < MaxMatch; k++, i++) {
+				costs[i + MaxMatch] = costs[i] + run_cost;
+				lengths[i + MaxMatch] = MaxMatch;
+			}
+		}
+
+		float cost = costs[i];
+		float literal = cost + model.literal[data[start + i]];
+		if(literal < costs[i + 1]) {
+			costs[i + 1] = literal;
+			lengths[i + 1] = 1;
+		}
+
+		size_t length = MinMatch;
+		size_t limit = n - i;
+		for(size_t m = match_offsets[i]; m < match_offsets[i + 1]; m++) {
+			const Match& match = matches[m];
+			double dist_cost = cost + GetDistCost(model, match.dist);
+			for(; length <= match.length && length <= limit; length++) {
+				float total = dist_cost + model.length[length];
+				if(total < costs[i + length]) {
+					costs[i + length] = total;
+					lengths[i + length] = length;
+				}
+			}
+		}
+		i++;
+	}
+
+	// Walk back from the end along the cheapest path
+	symbols.clear();
+	for(size_t pos = n; pos > 0; pos -= lengths[pos]) {
+		Symbol symbol;
+		symbol.litlen = lengths[pos];
+		symbol.dist = 0;
+		symbols.push_back(symbol);
+	}
+	std::reverse(symbols.begin(), symbols.end());
+
+	size_t pos = 0;
+	for(size_t s = 0; s < symbols.size(); s++) {
+		Symbol& symbol = symbols[s];
+		size_t length = symbol.litlen;
+		if(length == 1) {
+			symbol.litlen = data[start + pos];
+		} else {
+			symbol.dist = GetMatchDist(pos, length);
+		}
+		pos += length;
+	}
+}
+
+void OptimalDeflate::SplitBlocks(const std::vector<Symbol>& symbols,
+	size_t begin, size_t end, int depth, std::vector<size_t>& splits) const {
+	if(depth >= MaxSplitDepth || end - begin < MinBlockSymbols * 2) {
+		return;
+	}
+
+	// Narrows the range of split points around the best of a few samples
+	size_t low = begin + MinBlockSymbols;
+	size_t high = end - MinBlockSymbols;
+	size_t best_split = low;
+	double best_cost = std::numeric_limits<double>::infinity();
+	for(;;) {
+		size_t step = std::max<size_t>((high - low) / 10, 1);
+		for(size_t split = low; split <= high; split += step) {
+			double cost = GetBlockCost(symbols, begin, split)
+				+ GetBlockCost(symbols, split, end);
+			if(cost < best_cost) {
+				best_cost = cost;
+				best_split = split;
+			}
+		}
+		if(step == 1) {
+			break;
+		}
+		low = std::max(low, best_split - std::min(best_split, step));
+		high = std::min(high, best_split + step);
+	}
+
+	if(best_cost >= GetBlockCost(symbols, begin, end)) {
+		return;
+	}
+
+	SplitBlocks(symbols, begin, best_split, depth + 1, splits);
+	splits.push_back(best_split);
+	SplitBlocks(symbols, best_split, end, depth + 1, splits);
+}
+
+void OptimalDeflate::BuildBlockCode(const std::vector<Symbol>& symbols,
+	size_t begin, size_t end, BlockCode& code) const {
+	unsigned litlen_counts[288] = { 0 };
+	unsigned dist_counts[30] = { 0 };
+	double extra_bits = 0;
+	code.bytes = 0;
+	for(size_t i = begin; i < end; i++) {
+		const Symbol& symbol = symbols[i];
+		if(symbol.dist == 0) {
+			litlen_counts[symbol.litlen]++;
+			code.bytes++;
+		} else {
+			code.bytes += symbol.litlen;
+			litlen_counts[GetLengthSymbol(symbol.litlen)]++;
+			dist_counts[GetDistSymbol(symbol.dist)]++;
+			extra_bits += GetLengthExtraBits(symbol.litlen)
+				+ GetDistExtraBits(symbol.dist);
+		}
+	}
+	litlen_counts[256] = 1;
+
+	double fixed_bits = 3 + extra_bits;
+	for(int i = 0; i < 288; i++) {
+		fixed_bits += (double) litlen_counts[i] * GetFixedLength(i);
+	}
+	for(int i = 0; i < 30; i++) {
+		fixed_bits += (double) dist_counts[i] * 5;
+	}
+
+	BuildLengths(litlen_counts, 286, MaxBits, code.litlen_lengths);
+	code.litlen_lengths[286] = code.litlen_lengths[287] = 0;
+	BuildLengths(dist_counts, 30, MaxBits, code.dist_lengths);
+
+	// Code lengths are run length encoded like zlib does
+	code.litlen_count = 286;
+	while(code.litlen_count > 257
+		&& code.litlen_lengths[code.litlen_count - 1] == 0) {
+		code.litlen_count--;
+	}
+	code.dist_count = 30;
+	while(code.dist_count > 1 && code.dist_lengths[code.dist_count - 1] == 0) {
+		code.dist_count--;
+	}
+
+	unsigned char all[286 + 30];
+	size_t all_count = code.litlen_count + code.dist_count;
+	memcpy(all, code.litlen_lengths, code.litlen_count);
+	memcpy(all + code.litlen_count, code.dist_lengths, code.dist_count);
+
+	code.code_lengths.clear();
+	code.code_length_extra.clear();
+	for(size_t i = 0; i < all_count; ) {
+		unsigned char value = all[i];
+		size_t run = 1;
+		while(i + run < all_count && all[i + run] == value) {
+			run++;
+		}
+		i += run;
+
+		if(value == 0) {
+			while(run >= 11) {
+				size_t count = std::min<size_t>(run, 138);
+				code.code_lengths.push_back(18);
+				code.code_length_extra.push_back(count - 11);
+				run -= count;
+			}
+			if(run >= 3) {
+				code.code_lengths.push_back(17);
+				code.code_length_extra.push_back(run - 3);
+				run = 0;
+			}
+		} else {
+			code.code_lengths.push_back(value);
+			code.code_length_extra.push_back(0);
+			run--;
+			while(run >= 3) {
+				size_t count = std::min<size_t>(run, 6);
+				code.code_lengths.push_back(16);
+				code.code_length_extra.push_back(count - 3);
+				run -= count;
+			}
+		}
+		for(; run > 0; run--) {
+			code.code_lengths.push_back(value);
+			code.code_length_extra.push_back(0);
+		}
+	}
+
+	unsigned code_length_counts[19] = { 0 };
+	for(size_t i = 0; i < code.code_lengths.size(); i++) {
+		code_length_counts[code.code_lengths[i]]++;
+	}
+	BuildLengths(code_length_counts, 19, MaxCodeLengthBits,
+		code.code_length_lengths);
+	code.code_length_count = 19;
+	while(code.code_length_count > 4
+		&& code.code_length_lengths[code_length_order[
+			code.code_length_count - 1]] == 0) {
+		code.code_length_count--;
+	}
+
+	double dynamic_bits = 3 + 5 + 5 + 4 + 3 * code.code_length_count
+		+ extra_bits;
+	for(size_t i = 0; i < code.code_lengths.size(); i++) {
+		int symbol = code.code_lengths[i];
+		dynamic_bits += code.code_length_lengths[symbol]
+			+ GetCodeLengthExtraBits(symbol);
+	}
+	for(int i = 0; i < 286; i++) {
+		dynamic_bits += (double) litlen_counts[i] * code.litlen_lengths[i];
+	}
+	for(int i = 0; i < 30; i++) {
+		dynamic_bits += (double) dist_counts[i] * code.dist_lengths[i];
+	}
+
+	code.dynamic = dynamic_bits < fixed_bits;
+	code.bits = code.dynamic ? dynamic_bits : fixed_bits;
+
+	// Header, padding, LEN and NLEN of every stored block
+	size_t stored_count = std::max<size_t>(
+		(code.bytes + MaxStoredSize - 1) / MaxStoredSize, 1);
+	code.stored_bits = (double) stored_count * (3 + 7 + 32)
+		+ (double) code.bytes * 8;
+	if(!code.dynamic) {
+		for(int i = 0; i < 288; i++) {
+			code.litlen_lengths[i] = GetFixedLength(i);
+		}
+		memset(code.dist_lengths, 5, sizeof(code.dist_lengths));
+	}
+}
+
+double OptimalDeflate::GetBlockCost(const std::vector<Symbol>& symbols,
+	size_t begin, size_t end) const {
+	BlockCode code;
+	BuildBlockCode(symbols, begin, end, code);
+	return std::min(code.bits, code.stored_bits);
+}
+
+void OptimalDeflate::WriteBlock(const std::vector<Symbol>& symbols,
+	size_t begin, size_t end, size_t& offset, bool final) {
+	BlockCode code;
+	BuildBlockCode(symbols, begin, end, code);
+
+	// Incompressible data is cheaper as is, the padding is known here
+	double stored_bits = 0;
+	int used_bits = bit_count;
+	size_t left = code.bytes;
+	do {
+		size_t length = std::min(left, MaxStoredSize);
+		stored_bits += 3 + (8 - (used_bits + 3) % 8) % 8 + 32
+			+ (double) length * 8;
+		used_bits = 0;
+		left -= length;
+	} while(left > 0);
+
+	size_t block_offset = offset;
+	offset += code.bytes;
+	if(stored_bits < code.bits) {
+		WriteStored(block_offset, code.bytes, final);
+		return;
+	}
+
+	WriteBits(final ? 1 : 0, 1);
+	WriteBits(code.dynamic ? 2 : 1, 2);
+
+	if(code.dynamic) {
+		WriteBits(code.litlen_count - 257, 5);
+		WriteBits(code.dist_count - 1, 5);
+		WriteBits(code.code_length_count - 4, 4);
+		for(int i = 0; i < code.code_length_count; i++) {
+			WriteBits(code.code_length_lengths[code_length_order[i]], 3);
+		}
+
+		unsigned code_length_codes[19];
+		GetCodes(code.code_length_lengths, 19, code_length_codes);
+		for(size_t i = 0; i < code.code_lengths.size(); i++) {
+			int symbol = code.code_lengths[i];
+			WriteCode(code_length_codes[symbol],
+				code.code_length_lengths[symbol]);
+			WriteBits(code.code_length_extra[i],
+				GetCodeLengthExtraBits(symbol));
+		}
+	}
+
+	unsigned litlen_codes[288];
+	unsigned dist_codes[30];
+	GetCodes(code.litlen_lengths, 288, litlen_codes);
+	GetCodes(code.dist_lengths, 30, dist_codes);
+
+	for(size_t i = begin; i < end; i++) {
+		const Symbol& symbol = symbols[i];
+		if(symbol.dist == 0) {
+			WriteCode(litlen_codes[symbol.litlen],
+				code.litlen_lengths[symbol.litlen]);
+			continue;
+		}
+
+		int length_symbol = GetLengthSymbol(symbol.litlen);
+		WriteCode(litlen_codes[length_symbol],
+			code.litlen_lengths[length_symbol]);
+		WriteBits(GetLengthExtraValue(symbol.litlen),
+			GetLengthExtraBits(symbol.litlen));
+
+		int dist_symbol = GetDistSymbol(symbol.dist);
+		WriteCode(dist_codes[dist_symbol], code.dist_lengths[dist_symbol]);
+		WriteBits(GetDistExtraValue(symbol.dist),
+			GetDistExtraBits(symbol.dist));
+	}
+	WriteCode(litlen_codes[256], code.litlen_lengths[256]);
+}
+
+void OptimalDeflate::WriteStored(size_t offset, size_t bytes, bool final) {
+	do {
+		size_t length = std::min(bytes, MaxStoredSize);
+		bytes -= length;
+
+		WriteBits(final && bytes == 0 ? 1 : 0, 1);
+		WriteBits(0, 2);
+		if(bit_count > 0) {
+			WriteBits(0, 8 - bit_count);
+		}
+
+		out->push_back(length & 0xFF);
+		out->push_back(length >> 8);
+		out->push_back(~length & 0xFF);
+		out->push_back((~length >> 8) & 0xFF);
+		out->insert(out->end(), data + offset, data + offset + length);
+		offset += length;
+	} while(bytes > 0);
+}
+
+void OptimalDeflate::WriteBits(unsigned value, int bits) {
+	bit_buffer |= value << bit_count;
+	bit_count += bits;
+	while(bit_count >= 8) {
+		out->push_back(bit_buffer & 0xFF);
+		bit_buffer >>= 8;
+		bit_count -= 8;
+	}
+}
+
+void OptimalDeflate::WriteCode(unsigned code, int bits) {
+	// Huffman codes are stored starting with their most significant bit
+	unsigned reversed = 0;
+	for(int i = 0; i < bits; i++) {
+		reversed = (reversed << 1) | ((code >> i) & 1);
+	}
+	WriteBits(reversed, bits);
+}
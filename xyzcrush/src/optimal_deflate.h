@@ -0,0 +1,132 @@
+/*
+ * This file is part of xyzcrush. Copyright (c) 2018 xyzcrush authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef XYZCRUSH_OPTIMAL_DEFLATE_H
+#define XYZCRUSH_OPTIMAL_DEFLATE_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Slow deflate encoder that searches for the smallest output instead of
+ * being fast, in the spirit of zopfli.
+ *
+ * The input is handled in master blocks of 1 MiB. All matches of a master
+ * block are searched once, then the cheapest sequence of literals and
+ * matches is found by a shortest path search over the positions. The
+ * symbol costs of each pass are taken from the symbol statistics of the
+ * previous one, starting from the fixed Huffman codes. The best parse is
+ * split into deflate blocks where separate Huffman codes pay off, blocks
+ * that do not compress are stored.
+ *
+ * The output is a regular zlib stream, any inflate implementation reads
+ * it. An encoder keeps its buffers between calls, use one per thread.
+ */
+class OptimalDeflate {
+public:
+	/**
+	 * @param iterations number of cost model passes per master block,
+	 *                   more passes give smaller output in more time
+	 */
+	explicit OptimalDeflate(int iterations);
+
+	/**
+	 * Compresses data into a zlib stream.
+	 *
+	 * @param data input
+	 * @param size size of data in bytes
+	 * @param out receives the zlib stream, previous contents are replaced
+	 */
+	void Compress(const unsigned char* data, size_t size,
+		std::vector<unsigned char>& out);
+
+private:
+	OptimalDeflate(const OptimalDeflate&);
+	OptimalDeflate& operator=(const OptimalDeflate&);
+
+	/** Literal or match of a parse, dist is 0 for literals. */
+	struct Symbol {
+		unsigned short litlen;
+		unsigned short dist;
+	};
+
+	/** Longest match with a given distance, see FindMatches. */
+	struct Match {
+		unsigned short length;
+		unsigned short dist;
+	};
+
+	/** Bits of every literal, match length and distance symbol. */
+	struct CostModel {
+		double literal[256];
+		/** Including the extra bits, indexed by length. */
+		double length[259];
+		/** Excluding the extra bits. */
+		double dist[30];
+	};
+
+	/** Huffman codes of a deflate block and its size. */
+	struct BlockCode;
+
+	static void GetFixedCostModel(CostModel& model);
+	static void GetCostModel(const std::vector<Symbol>& symbols,
+		CostModel& model);
+	static double GetDistCost(const CostModel& model, size_t dist);
+
+	void FindMatches(size_t start, size_t end);
+	size_t GetMatchDist(size_t offset, size_t length) const;
+	void Parse(size_t start, size_t end, const CostModel& model,
+		std::vector<Symbol>& symbols);
+	void SplitBlocks(const std::vector<Symbol>& symbols, size_t begin,
+		size_t end, int depth, std::vector<size_t>& splits) const;
+	void BuildBlockCode(const std::vector<Symbol>& symbols, size_t begin,
+		size_t end, BlockCode& code) const;
+	double GetBlockCost(const std::vector<Symbol>& symbols, size_t begin,
+		size_t end) const;
+	void WriteBlock(const std::vector<Symbol>& symbols, size_t begin,
+		size_t end, size_t& offset, bool final);
+	void WriteStored(size_t offset, size_t bytes, bool final);
+	void WriteBits(unsigned value, int bits);
+	void WriteCode(unsigned code, int bits);
+
+	int iterations;
+	const unsigned char* data;
+	size_t size;
+
+	/** Hash chains over the last 32 KiB. */
+	std::vector<int> head;
+	std::vector<int> prev;
+	/**
+	 * Matches of each position of the current master block, ordered by
+	 * length. Lengths above the previous entry up to the length of an
+	 * entry are found at its distance.
+	 */
+	std::vector<Match> matches;
+	std::vector<unsigned> match_offsets;
+	/** Number of equal bytes starting at each position of the block. */
+	std::vector<unsigned short> same;
+
+	/** Shortest path search state. */
+	std::vector<float> costs;
+	std::vector<unsigned short> lengths;
+
+	std::vector<unsigned char>* out;
+	unsigned bit_buffer;
+	int bit_count;
+};
+
+#endif
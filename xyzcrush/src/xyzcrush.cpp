@@ -0,0 +1,911 @@
+/*
+ * This file is part of xyzcrush. Copyright (c) 2018 xyzcrush authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <zlib.h>
+#include <xyz.h>
+#include <xyz_dir.h>
+#include <xyz_file.h>
+#include <xyz_manifest.h>
+#include <xyz_palette.h>
+#include <xyz_pool.h>
+#include "crush_cache.h"
+#include "optimal_deflate.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#ifdef _WIN32
+# include <algorithm>
+#endif
+
+# ifdef __MINGW64_VERSION_MAJOR
+int _dowildcard = -1; /* enable wildcard expansion for mingw-w64 */
+# endif
+
+/** zlib parameters of a single compression attempt. */
+struct Trial {
+	int level;
+	int window_bits;
+	int mem_level;
+	int strategy;
+};
+
+/**
+ * Attempts made for every file, the strongest ones first so the others
+ * can give up early. Smaller windows and the filtered and RLE strategies
+ * sometimes win on images with short runs or few colors.
+ */
+const Trial trials[] = {
+	{ 9, 15, 9, Z_DEFAULT_STRATEGY },
+	{ 9, 15, 9, Z_FILTERED },
+	{ 9, 15, 8, Z_DEFAULT_STRATEGY },
+	{ 9, 15, 8, Z_FILTERED },
+	{ 8, 15, 9, Z_DEFAULT_STRATEGY },
+	{ 8, 15, 9, Z_FILTERED },
+	{ 7, 15, 9, Z_DEFAULT_STRATEGY },
+	{ 6, 15, 9, Z_DEFAULT_STRATEGY },
+	{ 6, 15, 9, Z_FILTERED },
+	{ 9, 14, 9, Z_DEFAULT_STRATEGY },
+	{ 9, 14, 9, Z_FILTERED },
+	{ 9, 13, 9, Z_DEFAULT_STRATEGY },
+	{ 9, 15, 9, Z_RLE },
+	{ 9, 15, 9, Z_HUFFMAN_ONLY }
+};
+
+const size_t TrialCount = sizeof(trials) / sizeof(trials[0]);
+
+/** Output size after which a trial checks whether it is still ahead. */
+const size_t TrialChunkSize = 16 * 1024;
+
+/** Largest -z pass count, each pass searches the whole image again. */
+const unsigned MaxIterations = 1000;
+
+/** Recompression settings from the command line. */
+struct Options {
+	/** Number of trials run in parallel. */
+	unsigned jobs;
+	/** Output directory, empty to replace the files in place. */
+	std::string output_dir;
+	/** Passes of the optimal parsing deflater, 0 disables it. */
+	int iterations;
+	/** Merge, sort and clear palette entries before compressing. */
+	bool optimize_palette;
+	/** Results of previous runs, NULL to try all settings on all files. */
+	CrushCache* cache;
+	/** Replace the palette by swap_palette instead of recompressing. */
+	bool swap;
+	unsigned char swap_palette[Xyz::PaletteSize];
+};
+
+/** A trial to run, index into trials or TrialCount for optimal deflate. */
+struct Attempt {
+	size_t trial;
+	/** Passes of the optimal deflater. */
+	int passes;
+};
+
+/** Sizes before and after of the files in a directory. */
+struct DirectoryTotals {
+	size_t original;
+	size_t crushed;
+};
+
+/** Totals of a batch run, shared by all jobs. */
+struct Batch {
+	std::mutex mutex;
+	/** Signalled whenever a file is finished. */
+	std::condition_variable file_done;
+	/** Number of files decoded but not yet finished. */
+	unsigned in_flight;
+	/** Receives one line per file, stdout unless XYZ data goes there. */
+	std::ostream* report;
+	int failed;
+	int total;
+	size_t original_total;
+	size_t crushed_total;
+	/** Totals per directory of the input files. */
+	std::map<std::string, DirectoryTotals> directories;
+};
+
+/**
+ * A file being recompressed. Created once the file is decoded and shared
+ * by all its trials, the last finished trial writes the result.
+ */
+struct CrushJob {
+	std::string filename;
+	std::string out_filename;
+	Xyz::Header header;
+	/** Palette directly followed by the pixels. */
+	std::vector<unsigned char> image;
+	/** The file as it was read. */
+	std::vector<unsigned char> original;
+	/** Hash of image, only set with a cache. */
+	unsigned long long hash;
+	/** The cache knows no smaller encoding, no trial was run. */
+	bool cached;
+
+	/** Guards best and best_settings. */
+	std::mutex mutex;
+	/** Smallest XYZ file so far, empty while none beats the original. */
+	std::vector<unsigned char> best;
+	/** Settings that produced best, see GetTrialName. */
+	std::string best_settings;
+	/** Size of the smallest XYZ file so far, trials above it give up. */
+	std::atomic<size_t> best_size;
+	/** Trials that have not finished yet. */
+	std::atomic<size_t> remaining;
+};
+
+/** Returns that path (everything left to the last /) */
+std::string GetPath(const std::string& str);
+
+/** Returns the output path of a file in an output directory. */
+std::string GetOutputFilename(const std::string& output_dir,
+	const std::string& name);
+
+/** Returns a short description of a trial, e.g. "9:15:8:filtered". */
+std::string GetTrialName(const Trial& trial);
+
+/**
+ * Finds the trial described by GetTrialName or by "optimal:passes".
+ *
+ * @return false for unknown settings
+ */
+bool ParseAttempt(const std::string& settings, Attempt& attempt);
+
+/**
+ * Chooses the trials of a file. Files the cache knows get the trial that
+ * won before, or none when they are as small as the cached result.
+ */
+std::vector<Attempt> GetAttempts(CrushJob& job, const Options& options);
+
+/**
+ * Reads and decodes a XYZ file, errors are written to err.
+ *
+ * @return the job for the trials, NULL on error
+ */
+std::shared_ptr<CrushJob> LoadFile(const std::string& filename,
+	const std::string& out_filename, const Options& options,
+	std::ostream& err);
+
+/**
+ * Deflates the image of a job with the settings of a trial and keeps the
+ * result when it is the smallest so far. Gives up as soon as the output
+ * is larger than the best one of the other trials.
+ */
+void RunTrial(CrushJob& job, const Trial& trial);
+
+/**
+ * Deflates the image of a job with the optimal parsing deflater and keeps
+ * the result when it is the smallest so far.
+ */
+void RunOptimalTrial(CrushJob& job, int iterations);
+
+/**
+ * Keeps a XYZ file as the best result of a job when it is smaller than
+ * the current one.
+ */
+void KeepIfSmaller(CrushJob& job, const unsigned char* data, size_t size,
+	const std::string& settings);
+
+/**
+ * Marks a trial of a job as done. The last one completes the job.
+ */
+void FinishTrial(CrushJob& job, const Options& options, Batch& batch);
+
+/**
+ * Writes the result of a job, records it in the cache and reports it.
+ */
+void CompleteJob(CrushJob& job, const Options& options, Batch& batch);
+
+/**
+ * Checks the best result of a job and writes it, or the original file
+ * when nothing was gained. Errors are written to err.
+ */
+bool FinishJob(CrushJob& job, std::ostream& err);
+
+/**
+ * Replaces the palette of a XYZ file written by png2xyz -w, the
+ * compressed pixels are copied unchanged. Errors are written to err.
+ *
+ * @param original_size receives the size of the file
+ * @param size receives the size of the new file
+ */
+bool SwapPalette(const std::string& filename,
+	const std::string& out_filename, const Options& options,
+	size_t& original_size, size_t& size, std::ostream& err);
+
+/**
+ * Writes a file with Xyz::ReplaceFile, so an interrupted run never
+ * leaves a truncated file behind. Errors are written to err.
+ */
+bool WriteFile(const std::string& filename, const unsigned char* data,
+	size_t size, std::ostream& err);
+
+std::string GetPath(const std::string& str) {
+	std::string s = str;
+#ifdef _WIN32
+	std::replace(s.begin(), s.end(), '\\', '/');
+#endif
+	// Path
+	size_t found = s.find_last_of("/");
+	if(found == std::string::npos)
+	{
+		return ".";
+	}
+
+	s = s.substr(0, found);
+	return s;
+}
+
+std::string GetOutputFilename(const std::string& output_dir,
+	const std::string& name) {
+	if(output_dir.empty()) {
+		return name;
+	}
+	return output_dir + "/" + name;
+}
+
+std::string GetTrialName(const Trial& trial) {
+	const char* strategy = "default";
+	switch(trial.strategy) {
+		case Z_FILTERED:
+			strategy = "filtered";
+			break;
+		case Z_HUFFMAN_ONLY:
+			strategy = "huffman";
+			break;
+		case Z_RLE:
+			strategy = "rle";
+			break;
+	}
+
+	std::ostringstream name;
+	name << trial.level << ":" << trial.window_bits << ":"
+		<< trial.mem_level << ":" << strategy;
+	return name.str();
+}
+
+bool ParseAttempt(const std::string& settings, Attempt& attempt) {
+	if(settings.compare(0, 8, "optimal:") == 0) {
+		char* end;
+		attempt.trial = TrialCount;
+		attempt.passes = strtol(settings.c_str() + 8, &end, 10);
+		return settings.size() > 8 && *end == '\0' && attempt.passes > 0;
+	}
+
+	for(size_t i = 0; i < TrialCount; i++) {
+		if(GetTrialName(trials[i]) == settings) {
+			attempt.trial = i;
+			attempt.passes = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<Attempt> GetAttempts(CrushJob& job, const Options& options) {
+	std::vector<Attempt> attempts;
+
+	// Results of runs with fewer optimal passes are not trusted
+	if(options.cache != NULL) {
+		job.hash = Xyz::Hash(job.image.data(), job.image.size());
+		CrushResult cached;
+		Attempt attempt;
+		if(options.cache->Find(job.hash, cached)
+			&& cached.passes >= options.iterations) {
+			if(job.original.size() <= cached.size) {
+				job.cached = true;
+				return attempts;
+			}
+			if(ParseAttempt(cached.settings, attempt)) {
+				attempts.push_back(attempt);
+				return attempts;
+			}
+		}
+	}
+
+	// The slow optimal trial goes first, the others finish meanwhile
+	if(options.iterations > 0) {
+		Attempt attempt = { TrialCount, options.iterations };
+		attempts.push_back(attempt);
+	}
+	for(size_t i = 0; i < TrialCount; i++) {
+		Attempt attempt = { i, 0 };
+		attempts.push_back(attempt);
+	}
+	return attempts;
+}
+
+std::shared_ptr<CrushJob> LoadFile(const std::string& filename,
+	const std::string& out_filename, const Options& options,
+	std::ostream& err) {
+	Xyz::InputFile file;
+	bool opened = filename == "-" ? file.OpenStdin() : file.Open(filename);
+	if(!opened) {
+		err << "Error reading file " << filename << "." << std::endl;
+		return std::shared_ptr<CrushJob>();
+	}
+
+	std::shared_ptr<CrushJob> job = std::make_shared<CrushJob>();
+	Xyz::Header header;
+	Xyz::Result result = Xyz::ReadHeader(file.GetData(), file.GetSize(),
+		header);
+	if(result == Xyz::Ok) {
+		size_t pixels_size = Xyz::GetPixelsSize(header);
+		job->image.resize(Xyz::PaletteSize + pixels_size);
+		result = Xyz::Decode(file.GetData(), file.GetSize(), header,
+			job->image.data(), job->image.data() + Xyz::PaletteSize,
+			pixels_size);
+	}
+	if(result != Xyz::Ok) {
+		err << "Error reading XYZ file " << filename << ": "
+			<< Xyz::GetResultString(result) << "." << std::endl;
+		return std::shared_ptr<CrushJob>();
+	}
+
+	// Trials compress the optimized image, the colors stay the same
+	if(options.optimize_palette) {
+		Xyz::OptimizePalette(job->image.data(),
+			job->image.data() + Xyz::PaletteSize,
+			job->image.size() - Xyz::PaletteSize);
+	}
+
+	job->filename = filename;
+	job->out_filename = out_filename;
+	job->header = header;
+	job->original.assign(file.GetData(), file.GetData() + file.GetSize());
+	job->hash = 0;
+	job->cached = false;
+	job->best_size = file.GetSize();
+	return job;
+}
+
+void RunTrial(CrushJob& job, const Trial& trial) {
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	if(deflateInit2(&strm, trial.level, Z_DEFLATED, trial.window_bits,
+		trial.mem_level, trial.strategy) != Z_OK) {
+		return;
+	}
+
+	// The header is copied from the original, it only holds the size
+	thread_local std::vector<unsigned char> out;
+	out.resize(Xyz::HeaderSize + deflateBound(&strm, job.image.size()));
+	memcpy(out.data(), job.original.data(), Xyz::HeaderSize);
+
+	strm.next_in = job.image.data();
+	strm.avail_in = job.image.size();
+	strm.next_out = out.data() + Xyz::HeaderSize;
+
+	int status = Z_OK;
+	while(status == Z_OK) {
+		if(Xyz::HeaderSize + strm.total_out >= job.best_size) {
+			break;
+		}
+		size_t left = out.size() - Xyz::HeaderSize - strm.total_out;
+		strm.avail_out = left < TrialChunkSize ? left : TrialChunkSize;
+		status = deflate(&strm, Z_FINISH);
+	}
+	size_t size = Xyz::HeaderSize + strm.total_out;
+	deflateEnd(&strm);
+
+	if(status == Z_STREAM_END) {
+		KeepIfSmaller(job, out.data(), size, GetTrialName(trial));
+	}
+}
+
+void RunOptimalTrial(CrushJob& job, int iterations) {
+	thread_local std::vector<unsigned char> stream;
+	OptimalDeflate deflater(iterations);
+	deflater.Compress(job.image.data(), job.image.size(), stream);
+
+	thread_local std::vector<unsigned char> out;
+	out.assign(job.original.begin(), job.original.begin() + Xyz::HeaderSize);
+	out.insert(out.end(), stream.begin(), stream.end());
+
+	std::ostringstream settings;
+	settings << "optimal:" << iterations;
+	KeepIfSmaller(job, out.data(), out.size(), settings.str());
+}
+
+void KeepIfSmaller(CrushJob& job, const unsigned char* data, size_t size,
+	const std::string& settings) {
+	std::lock_guard<std::mutex> lock(job.mutex);
+	if(size < job.best_size) {
+		job.best.assign(data, data + size);
+		job.best_settings = settings;
+		job.best_size = size;
+	}
+}
+
+void FinishTrial(CrushJob& job, const Options& options, Batch& batch) {
+	if(--job.remaining == 0) {
+		CompleteJob(job, options, batch);
+	}
+}
+
+void CompleteJob(CrushJob& job, const Options& options, Batch& batch) {
+	std::ostringstream err;
+	bool success = FinishJob(job, err);
+
+	size_t size = job.best.empty() ? job.original.size() : job.best.size();
+	std::string settings = job.best.empty() ? "-" : job.best_settings;
+	if(success && options.cache != NULL && !job.cached) {
+		CrushResult result = { size, options.iterations, settings };
+		options.cache->Store(job.hash, result);
+	}
+
+	std::lock_guard<std::mutex> lock(batch.mutex);
+	if(success) {
+		*batch.report << job.original.size() << "\t" << size << "\t"
+			<< (job.cached ? "cached" : settings)
+			<< "\t" << job.filename << "\n";
+		batch.original_total += job.original.size();
+		batch.crushed_total += size;
+		DirectoryTotals& directory = batch.directories[GetPath(job.filename)];
+		directory.original += job.original.size();
+		directory.crushed += size;
+	} else {
+		batch.failed++;
+	}
+	std::cerr << err.str();
+	batch.in_flight--;
+	batch.file_done.notify_all();
+}
+
+bool FinishJob(CrushJob& job, std::ostream& err) {
+	const unsigned char* data = job.original.data();
+	size_t size = job.original.size();
+
+	// A smaller stream is only used when it inflates to the same image
+	if(!job.best.empty()) {
+		std::vector<unsigned char> decoded(job.image.size());
+		Xyz::Header header;
+		Xyz::Result result = Xyz::Decode(job.best.data(), job.best.size(),
+			header, decoded.data(), decoded.data() + Xyz::PaletteSize,
+			decoded.size() - Xyz::PaletteSize);
+		if(result != Xyz::Ok || decoded != job.image) {
+			err << "Verification of recompressed "
+				<< job.filename << " failed." << std::endl;
+			return false;
+		}
+		data = job.best.data();
+		size = job.best.size();
+	}
+
+	if(job.out_filename == "-") {
+		Xyz::SetBinaryMode(stdout);
+		std::cout.write(reinterpret_cast<const char*>(data), size);
+		std::cout.flush();
+		if(!std::cout) {
+			err << "Error while writing XYZ data to standard output."
+				<< std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Files that cannot be improved are left alone
+	if(job.best.empty() && job.out_filename == job.filename) {
+		return true;
+	}
+
+	if(!Xyz::CreateDirectories(GetPath(job.out_filename))) {
+		err << "Error creating directory "
+			<< GetPath(job.out_filename) << "." << std::endl;
+		return false;
+	}
+	return WriteFile(job.out_filename, data, size, err);
+}
+
+bool SwapPalette(const std::string& filename,
+	const std::string& out_filename, const Options& options,
+	size_t& original_size, size_t& size, std::ostream& err) {
+	Xyz::InputFile file;
+	bool opened = filename == "-" ? file.OpenStdin() : file.Open(filename);
+	if(!opened) {
+		err << "Error reading file " << filename << "." << std::endl;
+		return false;
+	}
+
+	thread_local std::vector<unsigned char> out;
+	Xyz::Result result = Xyz::PatchPalette(file.GetData(), file.GetSize(),
+		options.swap_palette, out);
+	if(result == Xyz::ErrorNotSplit) {
+		err << "XYZ file " << filename << " has no separate palette,"
+			<< " convert it with png2xyz -w." << std::endl;
+		return false;
+	}
+	if(result != Xyz::Ok) {
+		err << "Error reading XYZ file " << filename << ": "
+			<< Xyz::GetResultString(result) << "." << std::endl;
+		return false;
+	}
+	original_size = file.GetSize();
+	size = out.size();
+
+	if(out_filename == "-") {
+		Xyz::SetBinaryMode(stdout);
+		std::cout.write(reinterpret_cast<const char*>(out.data()), size);
+		std::cout.flush();
+		if(!std::cout) {
+			err << "Error while writing XYZ data to standard output."
+				<< std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	if(!Xyz::CreateDirectories(GetPath(out_filename))) {
+		err << "Error creating directory "
+			<< GetPath(out_filename) << "." << std::endl;
+		return false;
+	}
+	file.Close();
+	return WriteFile(out_filename, out.data(), size, err);
+}
+
+bool WriteFile(const std::string& filename, const unsigned char* data,
+	size_t size, std::ostream& err) {
+	if(!Xyz::ReplaceFile(filename, data, size)) {
+		err << "Error while writing XYZ file "
+			<< filename << "." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	options.jobs = 0;
+	options.iterations = 0;
+	options.optimize_palette = false;
+	options.cache = NULL;
+	options.swap = false;
+	std::string cache_filename;
+	std::string swap_filename;
+	bool recursive = false;
+	int arg = 1;
+
+	for(; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; arg++) {
+		std::string option = argv[arg];
+		if(option == "--") {
+			arg++;
+			break;
+		} else if(option.compare(0, 2, "-c") == 0) {
+			cache_filename = option.substr(2);
+			if(cache_filename.empty() && arg + 1 < argc) {
+				cache_filename = argv[++arg];
+			}
+			if(cache_filename.empty()) {
+				std::cerr << "Missing cache filename." << std::endl;
+				return 1;
+			}
+		} else if(option.compare(0, 2, "-j") == 0) {
+			std::string value = option.substr(2);
+			if(value.empty() && arg + 1 < argc) {
+				value = argv[++arg];
+			}
+			if(!Xyz::WorkerPool::ParseSize(value, options.jobs)) {
+				std::cerr << "Invalid job count '" << value
+					<< "', use 0 (one per CPU) to "
+					<< Xyz::WorkerPool::GetMaxSize() << "." << std::endl;
+				return 1;
+			}
+		} else if(option == "-n") {
+			options.optimize_palette = true;
+		} else if(option.compare(0, 2, "-o") == 0) {
+			options.output_dir = option.substr(2);
+			if(options.output_dir.empty() && arg + 1 < argc) {
+				options.output_dir = argv[++arg];
+			}
+			if(options.output_dir.empty()) {
+				std::cerr << "Missing output directory." << std::endl;
+				return 1;
+			}
+		} else if(option == "-r") {
+			recursive = true;
+		} else if(option.compare(0, 2, "-s") == 0) {
+			swap_filename = option.substr(2);
+			if(swap_filename.empty() && arg + 1 < argc) {
+				swap_filename = argv[++arg];
+			}
+			if(swap_filename.empty()) {
+				std::cerr << "Missing palette filename." << std::endl;
+				return 1;
+			}
+			options.swap = true;
+		} else if(option.compare(0, 2, "-z") == 0) {
+			std::string value = option.substr(2);
+			if(value.empty() && arg + 1 < argc) {
+				value = argv[++arg];
+			}
+			unsigned long long iterations;
+			if(!Xyz::ParseNumber(value, 10, iterations)
+				|| iterations > MaxIterations) {
+				std::cerr << "Invalid iteration count '" << value
+					<< "', use 0 to " << MaxIterations << "." << std::endl;
+				return 1;
+			}
+			options.iterations = static_cast<int>(iterations);
+		} else {
+			std::cerr << "Unknown option " << option << "."
+				<< std::endl;
+			return 1;
+		}
+	}
+
+	if(arg >= argc)
+	{
+		std::cout << "Usage: " << argv[0]
+			<< " [-c cache] [-j jobs] [-n] [-o dir] [-r] [-s palette]"
+			<< " [-z passes]"
+			<< " filename [... filenameN]"
+			<< std::endl
+			<< std::endl
+			<< "  -c cache     remember the best result of every image,"
+			<< " known images only get" << std::endl
+			<< "               the settings that won before or are skipped"
+			<< std::endl
+			<< "  -j jobs      run this many compression trials or palette"
+			<< " swaps in parallel" << std::endl
+			<< "               (0: one per CPU)" << std::endl
+			<< "  -n           merge duplicate palette colors, sort the"
+			<< " palette by use and clear" << std::endl
+			<< "               unused entries, index 0 stays the"
+			<< " transparent color" << std::endl
+			<< "  -o dir       write the output files into this directory"
+			<< " instead of" << std::endl
+			<< "               replacing the input files" << std::endl
+			<< "  -r           recompress all XYZ files in the given"
+			<< " directories and their" << std::endl
+			<< "               subdirectories, the directory structure is"
+			<< " mirrored in the output" << std::endl
+			<< "  -s palette   instead of recompressing, replace the palette"
+			<< " by the one of this" << std::endl
+			<< "               XYZ file, the files must be converted with"
+			<< " png2xyz -w" << std::endl
+			<< "  -z passes    also run the optimal parsing deflater with"
+			<< " this many cost" << std::endl
+			<< "               model passes, much slower than zlib (e.g. 15"
+			<< " for releases)" << std::endl
+			<< std::endl
+			<< "Prints one line per file: original size, new size, winning"
+			<< " settings" << std::endl
+			<< "(level:window bits:memory level:strategy, optimal:passes,"
+			<< " -, cached or palette)" << std::endl
+			<< "and filename, followed by the bytes saved per directory."
+			<< std::endl
+			<< "A filename of - recompresses standard input to standard"
+			<< " output." << std::endl;
+		return 1;
+	}
+
+	// Only the palette is compressed when swapping it
+	if(options.swap) {
+		if(!cache_filename.empty() || options.optimize_palette
+			|| options.iterations > 0) {
+			std::cerr << "Option -s cannot be combined with -c, -p or -z."
+				<< std::endl;
+			return 1;
+		}
+
+		Xyz::InputFile file;
+		Xyz::Header header;
+		if(!file.Open(swap_filename) || Xyz::ReadPalette(file.GetData(),
+			file.GetSize(), header, options.swap_palette) != Xyz::Ok) {
+			std::cerr << "Error reading palette from "
+				<< swap_filename << "." << std::endl;
+			return 1;
+		}
+	}
+
+	CrushCache cache;
+	if(!cache_filename.empty()) {
+		if(!cache.Load(cache_filename)) {
+			std::cerr << "Error reading cache "
+				<< cache_filename << "." << std::endl;
+			return 1;
+		}
+		options.cache = &cache;
+	}
+
+	// The report must not mix with XYZ data on stdout
+	bool any_stdout = false;
+	for(int i = arg; i < argc; i++) {
+		any_stdout = any_stdout || std::string(argv[i]) == "-";
+	}
+
+	Batch batch;
+	batch.in_flight = 0;
+	batch.report = any_stdout ? &std::cerr : &std::cout;
+	batch.failed = 0;
+	batch.total = 0;
+	batch.original_total = 0;
+	batch.crushed_total = 0;
+	bool walk_failed = false;
+
+	// Source of every output file, e.g. d1/a.xyz and d2/a.xyz with -o
+	std::map<std::string, std::string> sources;
+
+	{
+		Xyz::WorkerPool pool(options.jobs);
+
+		// Only a few decoded images are kept around at once
+		unsigned max_in_flight = pool.GetSize() + 1;
+
+		auto submit = [&](const std::string& filename,
+			const std::string& out_filename) {
+			{
+				std::unique_lock<std::mutex> lock(batch.mutex);
+				batch.file_done.wait(lock, [&]() {
+					return batch.in_flight < max_in_flight;
+				});
+				batch.total++;
+			}
+
+			std::pair<std::map<std::string, std::string>::iterator, bool>
+				inserted = sources.insert(std::make_pair(out_filename,
+				filename));
+			if(!inserted.second) {
+				std::lock_guard<std::mutex> lock(batch.mutex);
+				std::cerr << "Skipping " << filename << ", "
+					<< inserted.first->second << " is recompressed to "
+					<< out_filename << " already." << std::endl;
+				batch.failed++;
+				return;
+			}
+
+			if(options.swap) {
+				{
+					std::lock_guard<std::mutex> lock(batch.mutex);
+					batch.in_flight++;
+				}
+
+				pool.Submit([filename, out_filename, &options, &batch]() {
+					std::ostringstream err;
+					size_t original_size;
+					size_t size;
+					bool swapped = SwapPalette(filename, out_filename,
+						options, original_size, size, err);
+					std::lock_guard<std::mutex> lock(batch.mutex);
+					std::cerr << err.str();
+					if(swapped) {
+						*batch.report << original_size << "\t" << size
+							<< "\tpalette\t" << filename << "\n";
+					} else {
+						batch.failed++;
+					}
+					batch.in_flight--;
+					batch.file_done.notify_all();
+				});
+				return;
+			}
+
+			std::ostringstream err;
+			std::shared_ptr<CrushJob> job = LoadFile(filename, out_filename,
+				options, err);
+			if(!job) {
+				std::lock_guard<std::mutex> lock(batch.mutex);
+				std::cerr << err.str();
+				batch.failed++;
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(batch.mutex);
+				batch.in_flight++;
+			}
+
+			std::vector<Attempt> attempts = GetAttempts(*job, options);
+			job->remaining = attempts.size();
+			if(attempts.empty()) {
+				CompleteJob(*job, options, batch);
+			}
+			for(size_t i = 0; i < attempts.size(); i++) {
+				Attempt attempt = attempts[i];
+				pool.Submit([job, attempt, &options, &batch]() {
+					if(attempt.trial == TrialCount) {
+						RunOptimalTrial(*job, attempt.passes);
+					} else {
+						RunTrial(*job, trials[attempt.trial]);
+					}
+					FinishTrial(*job, options, batch);
+				});
+			}
+		};
+
+		for(; arg < argc; arg++) {
+			std::string filename = argv[arg];
+
+			// Standard input is recompressed to standard output
+			if(filename == "-") {
+				submit(filename, filename);
+				continue;
+			}
+
+			if(!recursive) {
+				std::string name = filename;
+				if(!options.output_dir.empty()) {
+					size_t found = name.find_last_of("/\\");
+					if(found != std::string::npos) {
+						name = name.substr(found + 1);
+					}
+				}
+				submit(filename, GetOutputFilename(options.output_dir, name));
+				continue;
+			}
+
+			// Files are recompressed while the tree is still being walked
+			bool walked = Xyz::WalkDirectory(filename, ".xyz",
+				[&](const std::string& relative) {
+				submit(filename + "/" + relative, options.output_dir.empty() ?
+					filename + "/" + relative :
+					GetOutputFilename(options.output_dir, relative));
+			});
+			if(!walked) {
+				std::lock_guard<std::mutex> lock(batch.mutex);
+				std::cerr << "Error reading directory "
+					<< filename << "." << std::endl;
+				walk_failed = true;
+			}
+		}
+
+		pool.Wait();
+	}
+
+	if(options.cache != NULL && !cache.Save(cache_filename)) {
+		std::cerr << "Error writing cache "
+			<< cache_filename << "." << std::endl;
+		return 1;
+	}
+
+	if(options.swap) {
+		*batch.report << "Swapped the palette of "
+			<< batch.total - batch.failed << " files." << std::endl;
+	} else {
+		std::map<std::string, DirectoryTotals>::const_iterator it;
+		for(it = batch.directories.begin(); it != batch.directories.end();
+			++it) {
+			*batch.report << "Directory " << it->first << ": saved "
+				<< it->second.original - it->second.crushed << " of "
+				<< it->second.original << " bytes." << std::endl;
+		}
+
+		size_t saved = batch.original_total - batch.crushed_total;
+		*batch.report << "Crushed " << batch.total - batch.failed
+			<< " files, saved " << saved << " of "
+			<< batch.original_total << " bytes." << std::endl;
+	}
+
+	if(batch.failed > 0) {
+		std::cerr << batch.failed << " of " << batch.total
+			<< " files failed to " << (options.swap ? "swap the palette" :
+			"recompress") << "." << std::endl;
+		return 1;
+	}
+
+	return walk_failed ? 1 : 0;
+}
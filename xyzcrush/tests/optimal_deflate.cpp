@@ -0,0 +1,149 @@
+/*
+ * This file is part of xyzcrush. Copyright (c) 2015 xyzcrush authors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compresses empty, repetitive, image like and random data with the
+ * optimal parsing deflater, inflates it again with zlib and checks the
+ * contents. Random data must end up in stored blocks.
+ */
+
+#include "optimal_deflate.h"
+#include <zlib.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+	int failures = 0;
+
+	void Check(bool condition, const std::string& what) {
+		if(!condition) {
+			std::cerr << "FAIL: " << what << std::endl;
+			failures++;
+		}
+	}
+
+	std::vector<unsigned char> MakeRandom(size_t size, unsigned seed) {
+		std::vector<unsigned char> data(size);
+		for(size_t i = 0; i < size; i++) {
+			seed = seed * 1103515245 + 12345;
+			data[i] = (seed >> 16) & 0xFF;
+		}
+		return data;
+	}
+
+	/** Palette indices of a tiled image with some noise. */
+	std::vector<unsigned char> MakeImage(size_t width, size_t height) {
+		std::vector<unsigned char> noise = MakeRandom(width * height, 7);
+		std::vector<unsigned char> data(width * height);
+		for(size_t y = 0; y < height; y++) {
+			for(size_t x = 0; x < width; x++) {
+				size_t i = y * width + x;
+				data[i] = ((x / 16 + y / 16) % 5) * 20
+					+ (noise[i] < 16 ? noise[i] : 0);
+			}
+		}
+		return data;
+	}
+
+	/** Returns the zlib -9 size of data. */
+	size_t GetZlibSize(const std::vector<unsigned char>& data) {
+		uLongf size = compressBound(data.size());
+		std::vector<unsigned char> out(size);
+		compress2(out.data(), &size, data.data(), data.size(), 9);
+		return size;
+	}
+
+	/**
+	 * Compresses data, inflates it with zlib and compares the contents.
+	 * Returns the compressed stream.
+	 */
+	std::vector<unsigned char> CheckRoundTrip(OptimalDeflate& deflater,
+		const std::vector<unsigned char>& data, const std::string& what) {
+		std::vector<unsigned char> compressed;
+		deflater.Compress(data.data(), data.size(), compressed);
+
+		// One spare byte shows output beyond the original size
+		std::vector<unsigned char> inflated(data.size() + 1);
+		uLongf size = inflated.size();
+		int result = uncompress(inflated.data(), &size, compressed.data(),
+			compressed.size());
+		inflated.resize(size);
+		Check(result == Z_OK, what + ": inflates");
+		Check(result == Z_OK && inflated == data, what + ": same contents");
+		return compressed;
+	}
+}
+
+int main() {
+	OptimalDeflate deflater(3);
+
+	CheckRoundTrip(deflater, std::vector<unsigned char>(), "empty");
+	CheckRoundTrip(deflater, std::vector<unsigned char>(1, 42), "1 byte");
+
+	// Runs use matches with distance 1 and the longest length
+	std::vector<unsigned char> run(100000, 0);
+	std::vector<unsigned char> compressed = CheckRoundTrip(deflater, run,
+		"run");
+	Check(compressed.size() < 1000, "run: compresses");
+
+	std::vector<unsigned char> image = MakeImage(320, 240);
+	compressed = CheckRoundTrip(deflater, image, "image");
+	Check(compressed.size() <= GetZlibSize(image),
+		"image: not larger than zlib -9");
+
+	// More than one master block of 1 MiB, the second one refers back
+	// into the window of the first
+	const size_t master_size = 1 << 20;
+	std::vector<unsigned char> large = MakeRandom(master_size + 40000, 5);
+	std::copy(large.begin() + master_size - 20000,
+		large.begin() + master_size + 10000, large.end() - 30000);
+	compressed = CheckRoundTrip(deflater, large, "two master blocks");
+	Check(compressed.size() < large.size() - 20000,
+		"two master blocks: matches across the boundary");
+
+	// Random data is stored, in 64 KiB pieces with 5 byte headers
+	std::vector<unsigned char> noise = MakeRandom(200000, 1);
+	compressed = CheckRoundTrip(deflater, noise, "noise");
+	Check(compressed.size() > 2 && (compressed[2] & 6) == 0,
+		"noise: first block is stored");
+	Check(compressed.size() <= noise.size() + 4 * 5 + 6,
+		"noise: stored overhead only");
+	Check(compressed.size() <= GetZlibSize(noise),
+		"noise: not larger than zlib -9");
+
+	// Stored blocks between compressed ones start at any bit position
+	std::vector<unsigned char> mixed(image);
+	std::vector<unsigned char> random = MakeRandom(70000, 3);
+	mixed.insert(mixed.end(), random.begin(), random.end());
+	mixed.insert(mixed.end(), run.begin(), run.end());
+	mixed.insert(mixed.end(), random.begin(), random.begin() + 1000);
+	CheckRoundTrip(deflater, mixed, "mixed");
+
+	// Encoder buffers are reused between calls
+	CheckRoundTrip(deflater, image, "image again");
+
+	OptimalDeflate single_pass(1);
+	CheckRoundTrip(single_pass, mixed, "single pass");
+
+	if(failures != 0) {
+		std::cerr << failures << " checks failed." << std::endl;
+		return 1;
+	}
+	return 0;
+}